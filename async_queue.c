@@ -84,6 +84,45 @@ leave:
 	return data;
 }
 
+gpointer
+async_queue_pop_timed(AsyncQueue *queue,
+		      guint timeout)
+{
+	gpointer data = NULL;
+	GTimeVal tv;
+
+	g_mutex_lock(queue->mutex);
+
+	if (!queue->enabled)
+		goto leave;
+
+	/* wake-ups can be spurious; wait until the deadline */
+	g_get_current_time(&tv);
+	g_time_val_add(&tv, timeout * 1000);
+	while (!queue->tail && queue->enabled) {
+		if (!g_cond_timed_wait(queue->condition, queue->mutex, &tv))
+			break;
+	}
+
+	if (queue->tail) {
+		GList *node = queue->tail;
+		data = node->data;
+
+		queue->tail = node->prev;
+		if (queue->tail)
+			queue->tail->next = NULL;
+		else
+			queue->head = NULL;
+		queue->length--;
+		g_list_free_1(node);
+	}
+
+leave:
+	g_mutex_unlock(queue->mutex);
+
+	return data;
+}
+
 gpointer
 async_queue_pop_forced(AsyncQueue *queue)
 {
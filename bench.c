@@ -0,0 +1,492 @@
+/*
+ * Copyright (C) 2010 Felipe Contreras
+ *
+ * Author: Felipe Contreras <felipe.contreras@gmail.com>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+/*
+ * Micro-benchmarks for the primitives that run once or more per frame.
+ *
+ * Every benchmark prints a single line:
+ *
+ *   bench=<name> ops=<n> ns/op=<x> allocs/op=<y>
+ *
+ * Only the allocations done from this tree are counted; the ones inside
+ * glib and gstreamer go through the shared libraries' own malloc.
+ *
+ * There's no DSP on the host, so dmm_buffer_begin/end only measure the
+ * bookkeeping and the failing bridge ioctl.
+ *
+ * Build with -mfpu=neon to measure the NEON repacking.
+ */
+
+#include <gst/gst.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "gstdspparse.h"
+#include "gstdspvdec.h"
+#include "async_queue.h"
+#include "sem.h"
+#include "dmm_buffer.h"
+#include "yuv.h"
+#include "tidsp/td_h264dec_common.h"
+
+/* the binary is linked with --wrap for these */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+int __real_posix_memalign(void **memptr, size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+int __wrap_posix_memalign(void **memptr, size_t alignment, size_t size);
+
+static unsigned long alloc_count;
+
+void *__wrap_malloc(size_t size)
+{
+	alloc_count++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	alloc_count++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	alloc_count++;
+	return __real_realloc(ptr, size);
+}
+
+int __wrap_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	alloc_count++;
+	return __real_posix_memalign(memptr, alignment, size);
+}
+
+typedef void (*bench_func)(unsigned n);
+
+struct bench {
+	const char *name;
+	bench_func run;
+};
+
+static GstDspBase *dec;
+
+/* async_queue */
+
+static void bench_queue(unsigned n)
+{
+	AsyncQueue *queue;
+	unsigned i;
+
+	queue = async_queue_new();
+
+	for (i = 0; i < n; i++) {
+		async_queue_push(queue, GUINT_TO_POINTER(i + 1));
+		async_queue_pop(queue);
+	}
+
+	async_queue_free(queue);
+}
+
+static gpointer queue_consumer(gpointer data)
+{
+	AsyncQueue *queue = data;
+
+	while (async_queue_pop(queue) != GUINT_TO_POINTER(-1));
+
+	return NULL;
+}
+
+static void bench_queue_contended(unsigned n)
+{
+	AsyncQueue *queue;
+	GThread *thread;
+	unsigned i;
+
+	queue = async_queue_new();
+	thread = g_thread_create(queue_consumer, queue, TRUE, NULL);
+
+	for (i = 0; i < n; i++)
+		async_queue_push(queue, GUINT_TO_POINTER(i + 1));
+	async_queue_push(queue, GUINT_TO_POINTER(-1));
+
+	g_thread_join(thread);
+	async_queue_free(queue);
+}
+
+/* GSem */
+
+static void bench_sem(unsigned n)
+{
+	GSem *sem;
+	unsigned i;
+
+	sem = g_sem_new(0);
+
+	for (i = 0; i < n; i++) {
+		g_sem_up(sem);
+		g_sem_down(sem);
+	}
+
+	g_sem_free(sem);
+}
+
+struct ping_pong {
+	GSem *ping, *pong;
+	unsigned n;
+};
+
+static gpointer sem_ponger(gpointer data)
+{
+	struct ping_pong *pp = data;
+	unsigned i;
+
+	for (i = 0; i < pp->n; i++) {
+		g_sem_down(pp->ping);
+		g_sem_up(pp->pong);
+	}
+
+	return NULL;
+}
+
+static void bench_sem_ping_pong(unsigned n)
+{
+	struct ping_pong pp;
+	GThread *thread;
+	unsigned i;
+
+	pp.ping = g_sem_new(0);
+	pp.pong = g_sem_new(0);
+	pp.n = n;
+
+	thread = g_thread_create(sem_ponger, &pp, TRUE, NULL);
+
+	for (i = 0; i < n; i++) {
+		g_sem_up(pp.ping);
+		g_sem_down(pp.pong);
+	}
+
+	g_thread_join(thread);
+	g_sem_free(pp.ping);
+	g_sem_free(pp.pong);
+}
+
+/* timestamp ring, as used by pad_chain() and output_loop() */
+
+/* keeps the compiler from dropping the reads */
+static volatile GstClockTime ts_sink;
+
+static void bench_ts_ring(unsigned n)
+{
+	GstClockTime timestamp, duration;
+	unsigned i;
+
+	dec->ts_in_pos = dec->ts_out_pos = dec->ts_push_pos = 0;
+	dec->ts_count = 0;
+
+	for (i = 0; i < n; i++) {
+		g_mutex_lock(dec->ts_mutex);
+		gstdsp_ts_push(dec, i * GST_MSECOND, GST_MSECOND);
+		g_mutex_unlock(dec->ts_mutex);
+
+		g_mutex_lock(dec->ts_mutex);
+		gstdsp_ts_pop(dec, &timestamp, &duration);
+		g_mutex_unlock(dec->ts_mutex);
+
+		ts_sink = timestamp + duration;
+	}
+}
+
+/* dmm_buffer */
+
+#define FRAME_SIZE (640 * 480 * 3 / 2)
+
+static void bench_dmm_allocate(unsigned n)
+{
+	dmm_buffer_t *b;
+	unsigned i;
+
+	b = dmm_buffer_new(-1, NULL, DMA_FROM_DEVICE);
+
+	for (i = 0; i < n; i++)
+		dmm_buffer_allocate(b, FRAME_SIZE);
+
+	dmm_buffer_free(b);
+}
+
+static void bench_dmm_begin_end(unsigned n)
+{
+	dmm_buffer_t *b;
+	unsigned i;
+
+	b = dmm_buffer_new(-1, NULL, DMA_FROM_DEVICE);
+	dmm_buffer_allocate(b, FRAME_SIZE);
+
+	for (i = 0; i < n; i++) {
+#if DSP_API >= 2
+		b->dma_len = 0;
+#endif
+		dmm_buffer_begin(b, b->len);
+		dmm_buffer_end(b, b->len);
+	}
+
+	dmm_buffer_free(b);
+}
+
+/* encoder input repacking, VGA */
+
+#define CONV_WIDTH 640
+#define CONV_HEIGHT 480
+#define CONV_STRIDE 704
+
+static void bench_nv12_i420(unsigned n)
+{
+	guint8 *src, *dst;
+	unsigned i;
+
+	src = g_malloc0(CONV_STRIDE * CONV_HEIGHT * 3 / 2);
+	dst = g_malloc(FRAME_SIZE);
+
+	for (i = 0; i < n; i++) {
+		yuv_copy_plane(dst, CONV_WIDTH, src, CONV_STRIDE, CONV_WIDTH, CONV_HEIGHT);
+		yuv_split_uv(dst + CONV_WIDTH * CONV_HEIGHT,
+				dst + CONV_WIDTH * CONV_HEIGHT * 5 / 4, CONV_WIDTH / 2,
+				src + CONV_STRIDE * CONV_HEIGHT, CONV_STRIDE,
+				CONV_WIDTH / 2, CONV_HEIGHT / 2);
+	}
+
+	g_free(dst);
+	g_free(src);
+}
+
+static void bench_yuy2_uyvy(unsigned n)
+{
+	guint8 *src, *dst;
+	unsigned i;
+
+	src = g_malloc0(CONV_STRIDE * 2 * CONV_HEIGHT);
+	dst = g_malloc(CONV_WIDTH * 2 * CONV_HEIGHT);
+
+	for (i = 0; i < n; i++)
+		yuv_swap_bytes(dst, CONV_WIDTH * 2, src, CONV_STRIDE * 2,
+				CONV_WIDTH * 2, CONV_HEIGHT);
+
+	g_free(dst);
+	g_free(src);
+}
+
+/* NAL length prefix to start code */
+
+#define NAL_COUNT 8
+#define NAL_SIZE 1020
+
+static guint8 *nal_template(unsigned lol, size_t *size)
+{
+	guint8 *data, *p;
+	unsigned i;
+
+	*size = NAL_COUNT * (lol + NAL_SIZE);
+	p = data = g_malloc0(*size);
+
+	for (i = 0; i < NAL_COUNT; i++) {
+		if (lol == 4)
+			GST_WRITE_UINT32_BE(p, NAL_SIZE);
+		else
+			GST_WRITE_UINT16_BE(p, NAL_SIZE);
+		p[lol] = i ? 0x01 : 0x65;
+		p += lol + NAL_SIZE;
+	}
+
+	return data;
+}
+
+static void bench_nal(unsigned n, unsigned lol)
+{
+	GstDspVDec *vdec = GST_DSP_VDEC(dec);
+	struct td_buffer tb = { 0 };
+	dmm_buffer_t *b;
+	guint8 *data, *p;
+	size_t size;
+	unsigned i, j;
+
+	data = nal_template(lol, &size);
+	b = dmm_buffer_new(-1, NULL, DMA_TO_DEVICE);
+	tb.data = b;
+	vdec->priv.h264.lol = lol;
+
+	for (i = 0; i < n; i++) {
+		if (lol == 4) {
+			/* transformed in place; restore the prefixes */
+			for (j = 0, p = data; j < NAL_COUNT; j++, p += lol + NAL_SIZE)
+				GST_WRITE_UINT32_BE(p, NAL_SIZE);
+		}
+		/* a previous copy is owned in allocated_data and freed here */
+		dmm_buffer_use(b, data, size);
+		td_h264dec_transform_nal_encoding(vdec, &tb);
+	}
+
+	vdec->priv.h264.lol = 0;
+	dmm_buffer_free(b);
+	g_free(data);
+}
+
+static void bench_nal_lol4(unsigned n)
+{
+	bench_nal(n, 4);
+}
+
+static void bench_nal_lol2(unsigned n)
+{
+	bench_nal(n, 2);
+}
+
+/* parsers */
+
+/* CIF picture header */
+static const guint8 h263_header[] = {
+	0x00, 0x00, 0x80, 0x02, 0x0c, 0x08, 0x00, 0x00, 0x00,
+};
+
+/* 320x240 VOS, VO, VOL */
+static const guint8 mpeg4_header[] = {
+	0x00, 0x00, 0x01, 0xb0, 0x01, 0x00, 0x00, 0x01,
+	0xb5, 0x09, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+	0x01, 0x20, 0x00, 0x84, 0x40, 0x07, 0xa8, 0x50,
+	0x20, 0xf0, 0xff, 0xff, 0xff, 0xff, 0x80,
+};
+
+/* 320x240 baseline SPS */
+static const guint8 h264_header[] = {
+	0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0xc0, 0x0d,
+	0xda, 0x05, 0x07, 0xe4, 0xff, 0xff, 0xff, 0xff,
+};
+
+static void bench_parse(unsigned n,
+		bool (*parse)(GstDspBase *base, GstBuffer *buf),
+		const guint8 *data, unsigned size)
+{
+	GstDspVDec *vdec = GST_DSP_VDEC(dec);
+	GstBuffer *buf;
+	unsigned i;
+
+	/* the data is static, never owned by the buffer */
+	buf = gst_buffer_new();
+	GST_BUFFER_DATA(buf) = (guint8 *) data;
+	GST_BUFFER_SIZE(buf) = size;
+
+	for (i = 0; i < n; i++) {
+		dec->parsed = false;
+		vdec->width = vdec->height = 0;
+		vdec->crop_width = vdec->crop_height = 0;
+		if (!parse(dec, buf)) {
+			g_printerr("parse failed\n");
+			break;
+		}
+	}
+
+	GST_BUFFER_DATA(buf) = NULL;
+	GST_BUFFER_SIZE(buf) = 0;
+	gst_buffer_unref(buf);
+}
+
+static void bench_h263_parse(unsigned n)
+{
+	bench_parse(n, gst_dsp_h263_parse, h263_header, sizeof(h263_header));
+}
+
+static void bench_mpeg4_parse(unsigned n)
+{
+	bench_parse(n, gst_dsp_mpeg4_parse, mpeg4_header, sizeof(mpeg4_header));
+}
+
+static void bench_h264_parse(unsigned n)
+{
+	bench_parse(n, gst_dsp_h264_parse, h264_header, sizeof(h264_header));
+}
+
+static const struct bench benches[] = {
+	{ "async-queue", bench_queue },
+	{ "async-queue-contended", bench_queue_contended },
+	{ "sem", bench_sem },
+	{ "sem-ping-pong", bench_sem_ping_pong },
+	{ "ts-ring", bench_ts_ring },
+	{ "dmm-allocate", bench_dmm_allocate },
+	{ "dmm-begin-end", bench_dmm_begin_end },
+	{ "nv12-i420", bench_nv12_i420 },
+	{ "yuy2-uyvy", bench_yuy2_uyvy },
+	{ "nal-lol4", bench_nal_lol4 },
+	{ "nal-lol2", bench_nal_lol2 },
+	{ "h263-parse", bench_h263_parse },
+	{ "mpeg4-parse", bench_mpeg4_parse },
+	{ "h264-parse", bench_h264_parse },
+};
+
+static void run_bench(const struct bench *bench, unsigned n)
+{
+	unsigned long allocs;
+	GTimer *timer;
+	gdouble elapsed;
+
+	/* warm up */
+	bench->run(MAX(n / 100, 1));
+
+	timer = g_timer_new();
+	allocs = alloc_count;
+
+	bench->run(n);
+
+	elapsed = g_timer_elapsed(timer, NULL);
+	allocs = alloc_count - allocs;
+	g_timer_destroy(timer);
+
+	g_print("bench=%s ops=%u ns/op=%.1f allocs/op=%.2f\n",
+			bench->name, n,
+			elapsed * 1e9 / n,
+			(double) allocs / n);
+}
+
+GstDebugCategory *gstdsp_debug;
+
+int main(int argc, char *argv[])
+{
+	unsigned n = 100000;
+	const char *filter = NULL;
+	unsigned i;
+
+	gst_init(&argc, &argv);
+
+	if (argc >= 2)
+		n = MAX(atoi(argv[1]), 1);
+	if (argc >= 3)
+		filter = argv[2];
+
+#ifndef GST_DISABLE_GST_DEBUG
+	gstdsp_debug = _gst_debug_category_new("dsp", 0, "DSP stuff");
+#endif
+
+	dec = g_object_new(GST_DSP_VDEC_TYPE, NULL);
+
+	for (i = 0; i < G_N_ELEMENTS(benches); i++) {
+		if (filter && !strstr(benches[i].name, filter))
+			continue;
+		run_bench(&benches[i], n);
+	}
+
+	g_object_unref(dec);
+
+	return 0;
+}
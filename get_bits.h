@@ -13,38 +13,6 @@
 
 #include <stdint.h>
 
-struct get_bit_context {
-	const uint8_t *buffer, *buffer_end;
-	unsigned index;
-	unsigned size_in_bits;
-};
-
-static inline void skip_bits(struct get_bit_context *s, int n)
-{
-	unsigned index = s->index;
-	index += n;
-	s->index = index;
-}
-
-static inline void init_get_bits(struct get_bit_context *s, const uint8_t *buffer, unsigned bit_size)
-{
-	s->buffer = buffer;
-	s->buffer_end = buffer + ((bit_size + 7) >> 3);
-	s->size_in_bits = bit_size;
-	s->index = 0;
-}
-
-static inline unsigned get_bits1(struct get_bit_context *s)
-{
-	unsigned index = s->index;
-	uint8_t result = s->buffer[index >> 3];
-	result <<= (index & 0x07);
-	result >>= 8 - 1;
-	index++;
-	s->index = index;
-	return result;
-}
-
 union unaligned_16 { uint16_t l; } __attribute__((packed));
 union unaligned_32 { uint32_t l; } __attribute__((packed));
 
@@ -95,28 +63,104 @@ static inline uint32_t av_read32_be(const uint8_t *p)
 	 ((const uint8_t *)(x))[3])
 #endif
 
-static inline unsigned get_bits(struct get_bit_context *s, int n)
+/*
+ * The next bits of the stream are kept MSB-first in a 64-bit cache, which is
+ * refilled 32 bits at a time. Reads past the end of the buffer return zeros,
+ * but still advance the position, so get_bits_left() goes negative.
+ */
+
+struct get_bit_context {
+	const uint8_t *buffer, *buffer_end;
+	unsigned index;
+	unsigned size_in_bits;
+
+	const uint8_t *ptr;
+	uint64_t cache;
+	unsigned cache_bits;
+};
+
+static inline void refill_bits(struct get_bit_context *s)
 {
-	unsigned index = s->index;
-	int re_cache = 0;
-	register int tmp;
-	re_cache = AV_RB32(((const uint8_t *)s->buffer) + (index >> 3)) << (index & 0x07);
-	tmp = ((uint32_t)re_cache) >> (32 - n);
-	index += n;
-	s->index = index;
-	return tmp;
+	if (s->cache_bits <= 32 && s->buffer_end - s->ptr >= 4) {
+		s->cache |= (uint64_t) (uint32_t) AV_RB32(s->ptr) << (32 - s->cache_bits);
+		s->ptr += 4;
+		s->cache_bits += 32;
+	}
+	while (s->cache_bits <= 56 && s->ptr < s->buffer_end) {
+		s->cache |= (uint64_t) *s->ptr++ << (56 - s->cache_bits);
+		s->cache_bits += 8;
+	}
 }
 
+/* reload the cache from the current position */
+static inline void reset_bits_cache(struct get_bit_context *s)
+{
+	unsigned offset = s->index >> 3;
+	unsigned n = s->index & 0x07;
+
+	if (offset > (unsigned) (s->buffer_end - s->buffer))
+		offset = s->buffer_end - s->buffer;
+
+	s->ptr = s->buffer + offset;
+	s->cache = 0;
+	s->cache_bits = 0;
+	refill_bits(s);
+
+	if (n) {
+		s->cache <<= n;
+		s->cache_bits = s->cache_bits > n ? s->cache_bits - n : 0;
+	}
+}
+
+static inline void init_get_bits(struct get_bit_context *s, const uint8_t *buffer, unsigned bit_size)
+{
+	s->buffer = buffer;
+	s->buffer_end = buffer + ((bit_size + 7) >> 3);
+	s->size_in_bits = bit_size;
+	s->index = 0;
+	reset_bits_cache(s);
+}
+
+static inline void skip_bits(struct get_bit_context *s, int n)
+{
+	if ((unsigned) n < s->cache_bits) {
+		s->cache <<= n;
+		s->cache_bits -= n;
+		s->index += n;
+		return;
+	}
+
+	s->index += n;
+	reset_bits_cache(s);
+}
+
+/* n must be in the range 1-32 */
 static inline unsigned show_bits(struct get_bit_context *s, int n)
 {
-	unsigned index = s->index;
-	int re_cache = 0;
-	register int tmp;
-	re_cache = AV_RB32(((const uint8_t *)s->buffer) + (index >> 3)) << (index & 0x07);
-	tmp = ((uint32_t)re_cache) >> (32 - n);
+	if (s->cache_bits < (unsigned) n)
+		refill_bits(s);
+	return s->cache >> (64 - n);
+}
+
+static inline unsigned get_bits(struct get_bit_context *s, int n)
+{
+	unsigned tmp;
+
+	if (n == 0)
+		return 0;
+
+	tmp = show_bits(s, n);
+	s->cache <<= n;
+	s->cache_bits = s->cache_bits > (unsigned) n ? s->cache_bits - n : 0;
+	s->index += n;
 	return tmp;
 }
 
+static inline unsigned get_bits1(struct get_bit_context *s)
+{
+	return get_bits(s, 1);
+}
+
 static inline unsigned get_bits_count(const struct get_bit_context *s)
 {
 	return s->index;
@@ -127,4 +171,38 @@ static inline int get_bits_left(const struct get_bit_context *s)
 	return s->size_in_bits - get_bits_count(s);
 }
 
+/*
+ * Read unsigned Exp-Golomb code. Codes longer than 32 bits are invalid; the
+ * reader is then moved to the end, and 0 returned.
+ */
+static inline unsigned get_ue_golomb(struct get_bit_context *s)
+{
+	unsigned zeros;
+
+	if (s->cache_bits <= 32)
+		refill_bits(s);
+
+	zeros = s->cache ? __builtin_clzll(s->cache) : 64;
+	if (zeros > 31 || zeros >= s->cache_bits) {
+		if (get_bits_left(s) > 0)
+			skip_bits(s, get_bits_left(s));
+		return 0;
+	}
+
+	if (zeros < 16 && 2 * zeros + 1 <= s->cache_bits)
+		return get_bits(s, 2 * zeros + 1) - 1;
+
+	skip_bits(s, zeros);
+	return get_bits(s, zeros + 1) - 1;
+}
+
+/* read signed Exp-Golomb code */
+static inline int get_se_golomb(struct get_bit_context *s)
+{
+	unsigned i = get_ue_golomb(s);
+
+	/* (-1)^(i+1) Ceil (i / 2) */
+	return i & 1 ? (int) ((i + 1) >> 1) : -(int) (i >> 1);
+}
+
 #endif
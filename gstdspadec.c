@@ -13,10 +13,257 @@
 #include "log.h"
 #include "util.h"
 
+#include <string.h> /* for memcpy */
+
 #define GST_CAT_DEFAULT gstdsp_debug
 
 static GstDspBaseClass *parent_class;
 
+enum {
+	ARG_0,
+	ARG_BATCH_FRAMES,
+};
+
+#define DEFAULT_BATCH_FRAMES 8
+
+static const unsigned adts_rates[] = {
+	96000, 88200, 64000, 48000, 44100, 32000,
+	24000, 22050, 16000, 12000, 11025, 8000,
+};
+
+struct adts_header {
+	unsigned len;
+	unsigned rate;
+	unsigned channels;
+	unsigned samples;
+};
+
+static inline bool
+adts_parse_header(const guint8 *p, struct adts_header *h)
+{
+	unsigned idx;
+
+	/* syncword, layer */
+	if (p[0] != 0xff || (p[1] & 0xf6) != 0xf0)
+		return false;
+
+	idx = (p[2] >> 2) & 0xf;
+	if (idx >= ARRAY_SIZE(adts_rates))
+		return false;
+
+	h->len = (p[3] & 0x3) << 11 | p[4] << 3 | p[5] >> 5;
+	if (h->len < 7)
+		return false;
+
+	h->rate = adts_rates[idx];
+	h->channels = (p[2] & 0x1) << 2 | p[3] >> 6;
+	h->samples = 1024 * ((p[6] & 0x3) + 1);
+
+	return true;
+}
+
+/*
+ * An ADTS frame carries up to four raw data blocks of 1024 samples. With
+ * implicit SBR the output rate is twice the one in the header, and with
+ * parametric stereo mono comes out as stereo; neither can be told from
+ * the header, so there's always room for both.
+ */
+static inline void
+update_output_size(GstDspADec *self)
+{
+	GstDspBase *base = GST_DSP_BASE(self);
+	unsigned frames = self->batching ? self->batch_frames : 1;
+
+	base->output_buffer_size = frames * self->frame_samples * 2 * MAX(self->channels, 2) * 2;
+}
+
+static bool
+adts_parse(GstDspBase *base, GstBuffer *buf)
+{
+	GstDspADec *self = GST_DSP_ADEC(base);
+	struct adts_header h;
+
+	if (GST_BUFFER_SIZE(buf) < 7)
+		return false;
+
+	if (!adts_parse_header(GST_BUFFER_DATA(buf), &h))
+		return false;
+
+	pr_debug(self, "rate=%u, channels=%u, samples=%u", h.rate, h.channels, h.samples);
+
+	self->samplerate = self->adts_rate = h.rate;
+	self->frame_samples = MAX(self->frame_samples, h.samples);
+	if (h.channels)
+		self->channels = h.channels;
+
+	if (base->tmp_caps) {
+		gst_caps_set_simple(base->tmp_caps, "rate", G_TYPE_INT, self->samplerate, NULL);
+		if (self->channels)
+			gst_caps_set_simple(base->tmp_caps,
+					    "channels", G_TYPE_INT, self->channels, NULL);
+	}
+
+	update_output_size(self);
+
+	return true;
+}
+
+static GstFlowReturn
+push_batch(GstDspADec *self, GstPad *pad, unsigned len)
+{
+	GstBuffer *buf;
+
+	buf = gst_buffer_new_and_alloc(len);
+	memcpy(GST_BUFFER_DATA(buf), self->batch, len);
+	GST_BUFFER_TIMESTAMP(buf) = self->batch_ts;
+	GST_BUFFER_DURATION(buf) = self->batch_nr ? self->batch_duration : GST_CLOCK_TIME_NONE;
+
+	pr_debug(self, "batch of %u frames, %u bytes", self->batch_nr, len);
+
+	/* keep the remainder */
+	memmove(self->batch, self->batch + len, self->batch_len - len);
+	self->batch_len -= len;
+	self->batch_pos = self->batch_pos > len ? self->batch_pos - len : 0;
+	self->batch_nr = 0;
+	if (GST_CLOCK_TIME_IS_VALID(self->batch_ts))
+		self->batch_ts += self->batch_duration;
+	self->batch_duration = 0;
+
+	return self->base_chain(pad, buf);
+}
+
+static inline void
+reset_batch(GstDspADec *self)
+{
+	self->batch_len = self->batch_pos = self->batch_nr = 0;
+	self->batch_ts = GST_CLOCK_TIME_NONE;
+	self->batch_duration = 0;
+}
+
+static GstFlowReturn
+pad_chain(GstPad *pad,
+	  GstBuffer *buf)
+{
+	GstDspADec *self;
+	GstFlowReturn ret = GST_FLOW_OK;
+	unsigned size;
+
+	self = GST_DSP_ADEC(GST_OBJECT_PARENT(pad));
+
+	if (!self->batching)
+		return self->base_chain(pad, buf);
+
+	size = GST_BUFFER_SIZE(buf);
+
+	if (self->batch_len == 0 && GST_BUFFER_TIMESTAMP_IS_VALID(buf))
+		self->batch_ts = GST_BUFFER_TIMESTAMP(buf);
+
+	if (self->batch_len + size > self->batch_size) {
+		self->batch_size = self->batch_len + size;
+		self->batch = g_realloc(self->batch, self->batch_size);
+	}
+	memcpy(self->batch + self->batch_len, GST_BUFFER_DATA(buf), size);
+	self->batch_len += size;
+	gst_buffer_unref(buf);
+
+	while (self->batch_pos + 7 <= self->batch_len) {
+		struct adts_header h;
+
+		if (!adts_parse_header(self->batch + self->batch_pos, &h)) {
+			unsigned pos = self->batch_pos, junk = 1;
+
+			/* resync, and cut the junk out; the frames go back to back */
+			while (pos + junk + 7 <= self->batch_len &&
+					!adts_parse_header(self->batch + pos + junk, &h))
+				junk++;
+			pr_debug(self, "skipping %u bytes", junk);
+			memmove(self->batch + pos, self->batch + pos + junk,
+					self->batch_len - pos - junk);
+			self->batch_len -= junk;
+			continue;
+		}
+
+		if (self->batch_pos + h.len > self->batch_len)
+			break;
+
+		self->batch_pos += h.len;
+		self->batch_duration += gst_util_uint64_scale_int(h.samples, GST_SECOND, h.rate);
+
+		if (G_UNLIKELY(h.samples > self->frame_samples)) {
+			self->frame_samples = h.samples;
+			update_output_size(self);
+		}
+
+		if (++self->batch_nr < self->batch_frames)
+			continue;
+
+		ret = push_batch(self, pad, self->batch_pos);
+		if (ret != GST_FLOW_OK)
+			break;
+	}
+
+	return ret;
+}
+
+/*
+ * Split decoded batches back into frame sized buffers. The output rate and
+ * channels are taken from the negotiated caps, since SBR and PS change them
+ * from the ones in the ADTS header.
+ */
+static GstFlowReturn
+push_buffer(GstDspBase *base,
+	    GstBuffer *buf)
+{
+	GstDspADec *self = GST_DSP_ADEC(base);
+	GstClockTime timestamp = GST_BUFFER_TIMESTAMP(buf);
+	GstCaps *caps = GST_BUFFER_CAPS(buf);
+	GstStructure *struc;
+	int rate = 0, channels = 0;
+	unsigned sample_size, frame_size;
+	unsigned size = GST_BUFFER_SIZE(buf);
+	unsigned offset;
+	guint64 samples = 0;
+	GstFlowReturn ret = GST_FLOW_OK;
+
+	if (!caps || !self->adts_rate)
+		return gst_pad_push(base->srcpad, buf);
+
+	struc = gst_caps_get_structure(caps, 0);
+	if (!gst_structure_get_int(struc, "rate", &rate) ||
+			!gst_structure_get_int(struc, "channels", &channels) ||
+			rate <= 0 || channels <= 0)
+		return gst_pad_push(base->srcpad, buf);
+
+	sample_size = channels * 2;
+	frame_size = gst_util_uint64_scale_int(self->frame_samples, rate, self->adts_rate);
+	frame_size *= sample_size;
+
+	if (size <= frame_size)
+		return gst_pad_push(base->srcpad, buf);
+
+	for (offset = 0; offset < size && ret == GST_FLOW_OK; offset += frame_size) {
+		GstBuffer *sub;
+		unsigned len = MIN(frame_size, size - offset);
+
+		sub = gst_buffer_create_sub(buf, offset, len);
+		gst_buffer_set_caps(sub, GST_BUFFER_CAPS(buf));
+
+		if (GST_CLOCK_TIME_IS_VALID(timestamp)) {
+			GST_BUFFER_TIMESTAMP(sub) = timestamp +
+				gst_util_uint64_scale_int(samples, GST_SECOND, rate);
+			GST_BUFFER_DURATION(sub) =
+				gst_util_uint64_scale_int(len / sample_size, GST_SECOND, rate);
+		}
+		samples += len / sample_size;
+
+		ret = gst_pad_push(base->srcpad, sub);
+	}
+
+	gst_buffer_unref(buf);
+
+	return ret;
+}
+
 static inline GstCaps *
 generate_sink_template(void)
 {
@@ -153,8 +400,10 @@ configure_caps(GstDspADec *self,
 				"depth", G_TYPE_INT, 16,
 				NULL);
 
-	if (gst_structure_get_int(in_struc, "channels", &channels))
+	if (gst_structure_get_int(in_struc, "channels", &channels)) {
 		gst_structure_set(out_struc, "channels", G_TYPE_INT, channels, NULL);
+		self->channels = channels;
+	}
 
 	if (gst_structure_get_int(in_struc, "rate", &self->samplerate))
 		gst_structure_set(out_struc, "rate", G_TYPE_INT, self->samplerate, NULL);
@@ -165,11 +414,9 @@ configure_caps(GstDspADec *self,
 		gst_structure_get_boolean(in_struc, "framed", &tmp);
 		self->packetized = tmp;
 		fmt = gst_structure_get_string(in_struc, "stream-format");
-		self->raw = strcmp(fmt, "raw") == 0;
+		self->raw = fmt && strcmp(fmt, "raw") == 0;
 	}
 
-	base->output_buffer_size = 4 * 1024;
-
 	gst_caps_append_structure(out, out_struc);
 }
 
@@ -212,21 +459,124 @@ sink_setcaps(GstPad *pad,
 	configure_caps(self, caps, out_caps);
 	base->tmp_caps = out_caps;
 
+	/* raw frames can't be told apart once packed together */
+	self->batching = false;
+	base->parse_func = NULL;
+	if (base->alg == GSTDSP_AACDEC && !self->raw) {
+		base->parse_func = adts_parse;
+		if (self->batch_frames > 1) {
+			self->batching = true;
+			self->packetized = false;
+		}
+	}
+
+	self->adts_rate = 0;
+	self->frame_samples = 1024;
+	reset_batch(self);
+	update_output_size(self);
+
 	return TRUE;
 }
 
+static gboolean
+sink_event(GstDspBase *base,
+	   GstEvent *event)
+{
+	GstDspADec *self = GST_DSP_ADEC(base);
+
+	if (GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_STOP)
+		reset_batch(self);
+	else if (GST_EVENT_IS_SERIALIZED(event) && self->batch_len) {
+		GstFlowReturn ret = GST_FLOW_OK;
+		unsigned len;
+
+		/*
+		 * Keep the order with the pending frames; only the complete
+		 * ones, unless nothing else is coming.
+		 */
+		len = GST_EVENT_TYPE(event) == GST_EVENT_EOS ? self->batch_len : self->batch_pos;
+		if (len)
+			ret = push_batch(self, base->sinkpad, len);
+		if (ret != GST_FLOW_OK) {
+			pr_info(self, "pending frames push failed: %s", gst_flow_get_name(ret));
+			/* the EOS must get through anyway */
+			if (GST_EVENT_TYPE(event) != GST_EVENT_EOS) {
+				gst_event_unref(event);
+				return FALSE;
+			}
+		}
+	}
+
+	return parent_class->sink_event(base, event);
+}
+
+static void
+reset(GstDspBase *base)
+{
+	GstDspADec *self = GST_DSP_ADEC(base);
+
+	reset_batch(self);
+	g_free(self->batch);
+	self->batch = NULL;
+	self->batch_size = 0;
+}
+
+static void
+set_property(GObject *obj,
+	     guint prop_id,
+	     const GValue *value,
+	     GParamSpec *pspec)
+{
+	GstDspADec *self = GST_DSP_ADEC(obj);
+
+	switch (prop_id) {
+	case ARG_BATCH_FRAMES:
+		self->batch_frames = g_value_get_uint(value);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+get_property(GObject *obj,
+	     guint prop_id,
+	     GValue *value,
+	     GParamSpec *pspec)
+{
+	GstDspADec *self = GST_DSP_ADEC(obj);
+
+	switch (prop_id) {
+	case ARG_BATCH_FRAMES:
+		g_value_set_uint(value, self->batch_frames);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
+		break;
+	}
+}
+
 static void
 instance_init(GTypeInstance *instance,
 	      gpointer g_class)
 {
 	GstDspBase *base;
+	GstDspADec *self;
 
 	base = GST_DSP_BASE(instance);
+	self = GST_DSP_ADEC(instance);
 
 	base->use_pad_alloc = TRUE;
 	base->create_node = create_node;
+	base->push_buffer = push_buffer;
+	base->reset = reset;
+
+	self->batch_frames = DEFAULT_BATCH_FRAMES;
+	self->base_chain = GST_PAD_CHAINFUNC(base->sinkpad);
 
 	gst_pad_set_setcaps_function(base->sinkpad, sink_setcaps);
+	gst_pad_set_chain_function(base->sinkpad, pad_chain);
 }
 
 static void
@@ -262,7 +612,23 @@ static void
 class_init(gpointer g_class,
 	   gpointer class_data)
 {
+	GObjectClass *gobject_class;
+	GstDspBaseClass *base_class;
+
 	parent_class = g_type_class_peek_parent(g_class);
+	gobject_class = G_OBJECT_CLASS(g_class);
+	base_class = GST_DSP_BASE_CLASS(g_class);
+
+	gobject_class->set_property = set_property;
+	gobject_class->get_property = get_property;
+
+	g_object_class_install_property(gobject_class, ARG_BATCH_FRAMES,
+					g_param_spec_uint("batch-frames", "Batch frames",
+							  "Number of ADTS frames packed in each DSP buffer",
+							  1, 64, DEFAULT_BATCH_FRAMES,
+							  G_PARAM_READWRITE));
+
+	base_class->sink_event = sink_event;
 }
 
 GType
@@ -31,9 +31,22 @@ enum {
 struct GstDspADec {
 	GstDspBase element;
 	int samplerate;
+	int channels;
 	bool parametric_stereo;
 	bool packetized;
 	bool raw;
+	int adts_rate; /* before SBR */
+	unsigned frame_samples; /* per ADTS frame */
+
+	/* ADTS frames are packed together before hitting the DSP */
+	GstPadChainFunction base_chain;
+	unsigned batch_frames;
+	bool batching;
+	guint8 *batch;
+	unsigned batch_len, batch_size;
+	unsigned batch_pos; /* next frame header to check */
+	unsigned batch_nr; /* complete frames */
+	GstClockTime batch_ts, batch_duration;
 };
 
 struct GstDspADecClass {
@@ -224,6 +224,71 @@ dsp_unlock(GstDspBase *self, gboolean unlock)
 		if (GST_IS_DSP_IPP(self))
 			async_queue_enable(((GstDspIpp *) self)->ipp_queue);
 	}
+	if (self->unlock)
+		self->unlock(self, unlock);
+}
+
+void
+gstdsp_port_got_buffer(GstDspBase *self,
+		       du_port_t *p,
+		       struct dsp_msg *msg)
+{
+	dmm_buffer_t *b;
+	dsp_comm_t *msg_data;
+	dmm_buffer_t *param;
+	unsigned i;
+	struct td_buffer *tb = NULL;
+	int id = p->id;
+
+	pr_debug(self, "got %s buffer", id == 0 ? "input" : "output");
+
+	for (i = 0; i < p->num_buffers; i++) {
+		if (msg->arg_1 == (uint32_t) p->buffers[i].comm->map) {
+			tb = &p->buffers[i];
+			break;
+		}
+	}
+
+	if (!tb)
+		g_error("buffer mismatch");
+
+	dmm_buffer_end(tb->comm, tb->comm->size);
+
+	msg_data = tb->comm->data;
+	b = (void *) DSP_COMM_VER(self,msg_data,user_data);
+	b->len = DSP_COMM_VER(self,msg_data,buffer_len);
+
+	if (G_UNLIKELY(b->len > b->size))
+		g_error("wrong buffer size");
+
+	/* before the callbacks get to trim it */
+	tb->full = b->len == b->size;
+
+	if (tb->pinned)
+		/* the length of input buffers doesn't come back */
+		dmm_buffer_end(b, id == 0 ? b->size : b->len);
+	else
+		dmm_buffer_unmap(b);
+
+	param = (void *) DSP_COMM_VER(self,msg_data,param_virt);
+	if (param)
+		dmm_buffer_end(param, param->size);
+
+	/* clear time so sn might set its own */
+	if (id != 0 && tb->user_data)
+		GST_BUFFER_TIMESTAMP(tb->user_data) = GST_CLOCK_TIME_NONE;
+
+	if (p->recv_cb)
+		p->recv_cb(self, tb);
+
+	if (id == 0) {
+		if (tb->user_data) {
+			gst_buffer_unref(tb->user_data);
+			tb->user_data = NULL;
+		}
+	}
+
+	async_queue_push(p->queue, tb);
 }
 
 static inline void
@@ -238,12 +303,8 @@ got_message(GstDspBase *self,
 
 	switch (command_id) {
 	case 0x0600: {
-		dmm_buffer_t *b;
 		du_port_t *p;
-		dsp_comm_t *msg_data;
-		dmm_buffer_t *param;
 		unsigned i;
-		struct td_buffer *tb = NULL;
 
 		for (i = 0; i < ARRAY_SIZE(self->ports); i++)
 			if (self->ports[i]->id == id) {
@@ -254,51 +315,7 @@ got_message(GstDspBase *self,
 		if (i >= ARRAY_SIZE(self->ports))
 			g_error("bad port index: %i", id);
 
-		pr_debug(self, "got %s buffer", id == 0 ? "input" : "output");
-
-		for (i = 0; i < p->num_buffers; i++) {
-			if (msg->arg_1 == (uint32_t) p->buffers[i].comm->map) {
-				tb = &p->buffers[i];
-				break;
-			}
-		}
-
-		if (!tb)
-			g_error("buffer mismatch");
-
-		dmm_buffer_end(tb->comm, tb->comm->size);
-
-		msg_data = tb->comm->data;
-		b = (void *) DSP_COMM_VER(self,msg_data,user_data);
-		b->len = DSP_COMM_VER(self,msg_data,buffer_len);
-
-		if (G_UNLIKELY(b->len > b->size))
-			g_error("wrong buffer size");
-
-		if (tb->pinned)
-			dmm_buffer_end(b, b->len);
-		else
-			dmm_buffer_unmap(b);
-
-		param = (void *) DSP_COMM_VER(self,msg_data,param_virt);
-		if (param)
-			dmm_buffer_end(param, param->size);
-
-		/* clear time so sn might set its own */
-		if (id != 0 && tb->user_data)
-			GST_BUFFER_TIMESTAMP(tb->user_data) = GST_CLOCK_TIME_NONE;
-
-		if (p->recv_cb)
-			p->recv_cb(self, tb);
-
-		if (id == 0) {
-			if (tb->user_data) {
-				gst_buffer_unref(tb->user_data);
-				tb->user_data = NULL;
-			}
-		}
-
-		async_queue_push(p->queue, tb);
+		gstdsp_port_got_buffer(self, p, msg);
 		break;
 	}
 	case 0x0500:
@@ -347,6 +364,7 @@ setup_buffers(GstDspBase *self)
 	p = self->ports[0];
 	for (i = 0; i < p->num_buffers; i++) {
 		p->buffers[i].data = b = dmm_buffer_new(self->dsp_handle, self->proc, p->dir);
+		p->buffers[i].pinned = false;
 		async_queue_push(p->queue, &p->buffers[i]);
 	}
 
@@ -744,13 +762,8 @@ output_loop(gpointer data)
 		GST_BUFFER_FLAGS(out_buf) |= GST_BUFFER_FLAG_DELTA_UNIT;
 
 	g_mutex_lock(self->ts_mutex);
-	timestamp = self->ts_array[self->ts_out_pos].time;
-	duration = self->ts_array[self->ts_out_pos].duration;
+	gstdsp_ts_pop(self, &timestamp, &duration);
 	pr_debug(self, "in ts %" GST_TIME_FORMAT, GST_TIME_ARGS(timestamp));
-	self->ts_out_pos = (self->ts_out_pos + 1) % ARRAY_SIZE(self->ts_array);
-	self->ts_push_pos = self->ts_out_pos;
-	self->ts_count--;
-	g_cond_signal(self->ts_cond);
 
 	if (G_UNLIKELY(g_atomic_int_get(&self->deferred_eos)) && self->ts_count == 0)
 		got_eos = TRUE;
@@ -778,7 +791,10 @@ output_loop(gpointer data)
 	}
 	pr_debug(self, "pushing buffer %" GST_TIME_FORMAT,
 		 GST_TIME_ARGS(GST_BUFFER_TIMESTAMP(out_buf)));
-	ret = gst_pad_push(self->srcpad, out_buf);
+	if (self->push_buffer)
+		ret = self->push_buffer(self, out_buf);
+	else
+		ret = gst_pad_push(self->srcpad, out_buf);
 	if (G_UNLIKELY(ret != GST_FLOW_OK)) {
 		pr_info(self, "pad push failed: %s", gst_flow_get_name(ret));
 		goto leave;
@@ -1598,7 +1614,10 @@ pad_chain(GstPad *pad,
 	}
 
 next:
-	tb = async_queue_pop(p->queue);
+	if (self->input_timeout)
+		tb = async_queue_pop_timed(p->queue, self->input_timeout);
+	else
+		tb = async_queue_pop(p->queue);
 
 	ret = g_atomic_int_get(&self->status);
 	if (ret != GST_FLOW_OK) {
@@ -1608,8 +1627,38 @@ next:
 		goto leave;
 	}
 
+	if (G_UNLIKELY(!tb)) {
+		/* the DSP can't keep up; better lose this frame than stall upstream */
+		pr_info(self, "no free input buffer, dropping");
+		if (self->drop_buffer)
+			self->drop_buffer(self, buf);
+		goto leave;
+	}
+
 	b = tb->data;
 
+	if (self->convert_buffer) {
+		/* converted and copied in one pass, to memory mapped once */
+		if (!tb->pinned) {
+			dmm_buffer_allocate(b, self->input_buffer_size);
+			dmm_buffer_map(b);
+			tb->pinned = true;
+		}
+		b->len = self->input_buffer_size;
+		if (G_UNLIKELY(!self->convert_buffer(self, buf, tb))) {
+			async_queue_push(p->queue, tb);
+			if (self->drop_buffer)
+				self->drop_buffer(self, buf);
+			goto leave;
+		}
+		goto send;
+	}
+
+	if (G_UNLIKELY(tb->pinned)) {
+		dmm_buffer_unmap(b);
+		tb->pinned = false;
+	}
+
 	if (GST_BUFFER_SIZE(buf) >= self->input_buffer_size)
 		map_buffer(self, buf, tb);
 	else {
@@ -1624,12 +1673,9 @@ next:
                 b->need_copy = false;
 	}
 
+send:
 	g_mutex_lock(self->ts_mutex);
-	self->ts_array[self->ts_in_pos].time = GST_BUFFER_TIMESTAMP(buf);
-	self->ts_array[self->ts_in_pos].duration = GST_BUFFER_DURATION(buf);
-	b->ts_index = self->ts_in_pos;
-	self->ts_in_pos = (self->ts_in_pos + 1) % ARRAY_SIZE(self->ts_array);
-	self->ts_count++;
+	b->ts_index = gstdsp_ts_push(self, GST_BUFFER_TIMESTAMP(buf), GST_BUFFER_DURATION(buf));
 	g_mutex_unlock(self->ts_mutex);
 
 	ret = self->send_buffer(self, tb);
@@ -55,6 +55,7 @@ struct td_buffer {
 	bool keyframe;
 	bool pinned;
 	bool clean;
+	bool full; /* filled up by the DSP; most likely truncated */
 };
 
 struct du_port_t {
@@ -134,10 +135,17 @@ struct _GstDspBase {
 	void *(*create_node)(GstDspBase *base);
 	bool (*parse_func)(GstDspBase *base, GstBuffer *buf);
 	void (*pre_process_buffer)(GstDspBase *base, GstBuffer *buf);
+	/* fills a pinned input buffer, instead of mapping or copying */
+	bool (*convert_buffer)(GstDspBase *base, GstBuffer *buf, struct td_buffer *tb);
 	void (*reset)(GstDspBase *base);
+	/* disables or enables the queues of extra ports */
+	void (*unlock)(GstDspBase *base, gboolean unlock);
 	void (*flush_buffer)(GstDspBase *base);
 	void (*got_message)(GstDspBase *self, struct dsp_msg *msg);
 	GstFlowReturn (*send_buffer)(GstDspBase *self, struct td_buffer *tb);
+	/* sends back a released pinned buffer, without the pool lock held */
+	void (*recycle_buffer)(GstDspBase *self, struct td_buffer *tb, gint cycle);
+	GstFlowReturn (*push_buffer)(GstDspBase *self, GstBuffer *buf);
 	bool (*send_play_message)(GstDspBase *self);
 	bool (*send_stop_message)(GstDspBase *self);
 	GstCaps *tmp_caps;
@@ -145,6 +153,8 @@ struct _GstDspBase {
 
 	struct timespec eos_start;
 	gint eos_timeout; /* how much to wait for the EOS from DSP (ms) */
+	guint input_timeout; /* how much to wait for a free input buffer (ms) */
+	void (*drop_buffer)(GstDspBase *self, GstBuffer *buf);
 	int qos;
 
 	GstBuffer *codec_data;
@@ -178,6 +188,7 @@ gboolean gstdsp_reinit(GstDspBase *base);
 void gstdsp_got_error(GstDspBase *self, guint id, const char *message);
 void gstdsp_post_error(GstDspBase *self, const char *message);
 void gstdsp_send_alg_ctrl(GstDspBase *self, struct dsp_node *node, dmm_buffer_t *b);
+void gstdsp_port_got_buffer(GstDspBase *self, du_port_t *p, struct dsp_msg *msg);
 void gstdsp_base_flush_buffer(GstDspBase *self);
 
 typedef void (*gstdsp_setup_params_func)(GstDspBase *base, dmm_buffer_t *b);
@@ -199,6 +210,33 @@ static inline void gstdsp_port_setup_params(GstDspBase *self,
 	}
 }
 
+/* timestamp ring; called with ts_mutex held */
+
+static inline unsigned gstdsp_ts_push(GstDspBase *self,
+				      GstClockTime time,
+				      GstClockTime duration)
+{
+	unsigned pos = self->ts_in_pos;
+	self->ts_array[pos].time = time;
+	self->ts_array[pos].duration = duration;
+	self->ts_in_pos = (pos + 1) % ARRAY_SIZE(self->ts_array);
+	self->ts_count++;
+	return pos;
+}
+
+static inline void gstdsp_ts_pop(GstDspBase *self,
+				 GstClockTime *time,
+				 GstClockTime *duration)
+{
+	unsigned pos = self->ts_out_pos;
+	*time = self->ts_array[pos].time;
+	*duration = self->ts_array[pos].duration;
+	self->ts_out_pos = (pos + 1) % ARRAY_SIZE(self->ts_array);
+	self->ts_push_pos = self->ts_out_pos;
+	self->ts_count--;
+	g_cond_signal(self->ts_cond);
+}
+
 /* this is saner than gst_pad_set_caps() */
 static inline bool gst_pad_take_caps(GstPad *pad, GstCaps *caps)
 {
@@ -50,11 +50,20 @@ GstBuffer *gst_dsp_buffer_new(GstDspBase *base, struct td_buffer *tb)
 	return buf;
 }
 
+/* the pinned buffer behind, or NULL for any other kind of buffer */
+struct td_buffer *gst_dsp_buffer_get_td(GstBuffer *buf)
+{
+	if (!G_TYPE_CHECK_INSTANCE_TYPE(buf, type))
+		return NULL;
+	return ((GstDspBuffer *) buf)->tb;
+}
+
 static void finalize(GstMiniObject *obj)
 {
 	GstDspBuffer *dsp_buf = (GstDspBuffer *) obj;
 	GstDspBase *base = dsp_buf->base;
 	struct td_buffer *tb = dsp_buf->tb;
+	bool recycle = false;
 
 	g_mutex_lock(base->pool_mutex);
 	/* note: in this order, as ->tb may no longer be around */
@@ -63,12 +72,22 @@ static void finalize(GstMiniObject *obj)
 			tb->clean = true;
 		g_assert(!tb->data->data);
 		g_assert(!tb->data->allocated_data);
-		tb->data->data = GST_BUFFER_DATA(dsp_buf);
+		/* the data might have been trimmed in front */
+		if (GST_BUFFER_MALLOCDATA(dsp_buf))
+			tb->data->data = GST_BUFFER_MALLOCDATA(dsp_buf);
+		else
+			tb->data->data = GST_BUFFER_DATA(dsp_buf);
 		tb->data->allocated_data = GST_BUFFER_MALLOCDATA(dsp_buf);
 		GST_BUFFER_MALLOCDATA(dsp_buf) = NULL;
-		base->send_buffer(base, tb);
+		if (base->recycle_buffer)
+			recycle = true;
+		else
+			base->send_buffer(base, tb);
 	}
 	g_mutex_unlock(base->pool_mutex);
+	/* it checks the cycle again itself */
+	if (recycle)
+		base->recycle_buffer(base, tb, dsp_buf->cookie);
 	gst_object_unref(base);
 	parent_class->finalize(obj);
 }
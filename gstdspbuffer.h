@@ -18,5 +18,6 @@
 GType gst_dsp_buffer_get_type(void);
 
 GstBuffer *gst_dsp_buffer_new(GstDspBase *base, struct td_buffer *tb);
+struct td_buffer *gst_dsp_buffer_get_td(GstBuffer *buf);
 
 #endif /* GST_DSP_BASE_H */
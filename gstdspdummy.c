@@ -15,11 +15,21 @@
 #include "dsp_bridge.h"
 
 #include <string.h> /* for memcpy */
+#include <stdlib.h> /* for qsort */
+#include <time.h>
 
 #define GST_CAT_DEFAULT gstdsp_debug
 
 static GstElementClass *parent_class;
 
+enum {
+	ARG_0,
+	ARG_BENCHMARK,
+	ARG_IN_SIZE,
+	ARG_OUT_SIZE,
+	ARG_STATS,
+};
+
 static GstCaps *
 generate_src_template(void)
 {
@@ -213,12 +223,16 @@ _dsp_start(GstDspDummy *self)
 	return TRUE;
 }
 
+static void bench_free(GstDspDummy *self);
+
 static gboolean
 _dsp_stop(GstDspDummy *self)
 {
 	unsigned long exit_status;
 	unsigned i;
 
+	bench_free(self);
+
 	dmm_buffer_free(self->out_buffer);
 	dmm_buffer_free(self->in_buffer);
 
@@ -362,6 +376,191 @@ static bool check_events(GstDspDummy *self,
 	}
 }
 
+static inline guint64 get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+/*
+ * Benchmark mode: the dummy node has a single input and output pair, so
+ * one request is in flight at a time. The buffers are allocated, mapped
+ * and given to the node once; only the messages and the cache maintenance
+ * are measured.
+ */
+
+static void
+bench_setup(GstDspDummy *self,
+	    guint size)
+{
+	guint in_size = self->in_size ? self->in_size : size;
+	guint out_size = self->out_size ? self->out_size : size;
+
+	self->bench_in = dmm_buffer_new(self->dsp_handle, self->proc, DMA_TO_DEVICE);
+	dmm_buffer_allocate(self->bench_in, in_size);
+	memset(self->bench_in->data, 0, in_size);
+	dmm_buffer_map(self->bench_in);
+
+	self->bench_out = dmm_buffer_new(self->dsp_handle, self->proc, DMA_FROM_DEVICE);
+	dmm_buffer_allocate(self->bench_out, out_size);
+	dmm_buffer_map(self->bench_out);
+
+	configure_dsp_node(self->dsp_handle, self->node, self->bench_in, self->bench_out);
+
+	g_mutex_lock(self->stats_mutex);
+	memset(&self->stats, 0, sizeof(self->stats));
+	self->stats.min = G_MAXUINT64;
+	g_mutex_unlock(self->stats_mutex);
+
+	pr_info(self, "benchmark: in=%u out=%u", in_size, out_size);
+}
+
+static void
+bench_free(GstDspDummy *self)
+{
+	dmm_buffer_free(self->bench_in);
+	dmm_buffer_free(self->bench_out);
+	self->bench_in = self->bench_out = NULL;
+}
+
+static bool
+bench_run(GstDspDummy *self)
+{
+	dmm_buffer_t *in = self->bench_in, *out = self->bench_out;
+	struct dummy_stats *stats = &self->stats;
+	struct dsp_msg msg;
+	guint64 start, now, latency;
+
+	start = get_time();
+	dmm_buffer_begin(in, in->size);
+	dmm_buffer_begin(out, out->size);
+
+	msg.cmd = 1;
+	msg.arg_1 = in->size;
+	dsp_node_put_message(self->dsp_handle, self->node, &msg, -1);
+
+	if (!dsp_node_get_message(self->dsp_handle, self->node, &msg, 1000)) {
+		got_error(self, -1, "timed out waiting for the DSP");
+		return false;
+	}
+
+	dmm_buffer_end(in, in->size);
+	dmm_buffer_end(out, out->size);
+
+	now = get_time();
+	latency = now - start;
+
+	g_mutex_lock(self->stats_mutex);
+	stats->samples[stats->count % DUMMY_SAMPLES] = latency;
+	stats->count++;
+	stats->total += latency;
+	if (latency < stats->min)
+		stats->min = latency;
+	if (latency > stats->max)
+		stats->max = latency;
+	stats->in_bytes += in->size;
+	stats->out_bytes += out->size;
+	g_mutex_unlock(self->stats_mutex);
+
+	return true;
+}
+
+static int
+sample_cmp(const void *a,
+	   const void *b)
+{
+	const guint64 *x = a, *y = b;
+	return *x < *y ? -1 : *x > *y;
+}
+
+static GstStructure *
+get_stats(GstDspDummy *self)
+{
+	struct dummy_stats *stats;
+	GstStructure *s;
+	guint64 p99 = 0;
+	guint n;
+
+	stats = g_new(struct dummy_stats, 1);
+	g_mutex_lock(self->stats_mutex);
+	memcpy(stats, &self->stats, sizeof(*stats));
+	g_mutex_unlock(self->stats_mutex);
+
+	/* the percentile is over the last samples */
+	n = MIN(stats->count, DUMMY_SAMPLES);
+	if (n) {
+		qsort(stats->samples, n, sizeof(*stats->samples), sample_cmp);
+		p99 = stats->samples[(n * 99 - 1) / 100];
+	}
+
+	s = gst_structure_new("dspdummy-stats",
+			"count", G_TYPE_UINT, stats->count,
+			"latency-min", G_TYPE_UINT64, stats->count ? stats->min : 0,
+			"latency-avg", G_TYPE_UINT64, stats->count ? stats->total / stats->count : 0,
+			"latency-p99", G_TYPE_UINT64, p99,
+			"latency-max", G_TYPE_UINT64, stats->max,
+			/* over the round trips only, not the time in between */
+			"in-rate", G_TYPE_DOUBLE, stats->total ? (double) stats->in_bytes / stats->total : 0.0,
+			"out-rate", G_TYPE_DOUBLE, stats->total ? (double) stats->out_bytes / stats->total : 0.0,
+			NULL);
+
+	g_free(stats);
+
+	return s;
+}
+
+static void
+bench_report(GstDspDummy *self)
+{
+	GstStructure *s;
+	gchar *str;
+
+	s = get_stats(self);
+
+	str = gst_structure_to_string(s);
+	pr_info(self, "%s", str);
+	g_free(str);
+
+	gst_element_post_message(GST_ELEMENT(self),
+			gst_message_new_element(GST_OBJECT(self), s));
+}
+
+static GstFlowReturn
+bench_chain(GstDspDummy *self,
+	    GstBuffer *buf)
+{
+	if (G_UNLIKELY(!self->bench_in))
+		bench_setup(self, GST_BUFFER_SIZE(buf));
+
+	if (!bench_run(self)) {
+		gst_buffer_unref(buf);
+		return GST_FLOW_ERROR;
+	}
+
+	/* the DSP worked on its own buffers; the data just passes through */
+	return gst_pad_push(self->srcpad, buf);
+}
+
+static gboolean
+sink_event(GstPad *pad,
+	   GstEvent *event)
+{
+	GstDspDummy *self;
+	gboolean ret;
+
+	self = GST_DSP_DUMMY(gst_pad_get_parent(pad));
+
+	if (self->benchmark && GST_EVENT_TYPE(event) == GST_EVENT_EOS && self->bench_in)
+		bench_report(self);
+
+	ret = gst_pad_event_default(pad, event);
+
+	gst_object_unref(self);
+
+	return ret;
+}
+
 static GstFlowReturn
 pad_chain(GstPad *pad,
 	  GstBuffer *buf)
@@ -372,6 +571,9 @@ pad_chain(GstPad *pad,
 
 	self = GST_DSP_DUMMY(GST_OBJECT_PARENT(pad));
 
+	if (self->benchmark)
+		return bench_chain(self, buf);
+
 	ret = gst_pad_alloc_buffer_and_set_caps(self->srcpad,
 						GST_BUFFER_OFFSET_NONE,
 						GST_BUFFER_SIZE(buf),
@@ -431,6 +633,62 @@ leave:
 	return ret;
 }
 
+static void
+set_property(GObject *obj,
+	     guint prop_id,
+	     const GValue *value,
+	     GParamSpec *pspec)
+{
+	GstDspDummy *self = GST_DSP_DUMMY(obj);
+
+	switch (prop_id) {
+	case ARG_BENCHMARK:
+		/* the node gets configured for it with the first buffer */
+		if (GST_STATE(self) <= GST_STATE_READY)
+			self->benchmark = g_value_get_boolean(value);
+		else
+			GST_WARNING_OBJECT(self,
+					"benchmark property can be set only in NULL or READY state");
+		break;
+	case ARG_IN_SIZE:
+		self->in_size = g_value_get_uint(value);
+		break;
+	case ARG_OUT_SIZE:
+		self->out_size = g_value_get_uint(value);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+get_property(GObject *obj,
+	     guint prop_id,
+	     GValue *value,
+	     GParamSpec *pspec)
+{
+	GstDspDummy *self = GST_DSP_DUMMY(obj);
+
+	switch (prop_id) {
+	case ARG_BENCHMARK:
+		g_value_set_boolean(value, self->benchmark);
+		break;
+	case ARG_IN_SIZE:
+		g_value_set_uint(value, self->in_size);
+		break;
+	case ARG_OUT_SIZE:
+		g_value_set_uint(value, self->out_size);
+		break;
+	case ARG_STATS:
+		g_value_take_boxed(value, get_stats(self));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
+		break;
+	}
+}
+
 static void
 instance_init(GTypeInstance *instance,
 	      gpointer g_class)
@@ -445,6 +703,7 @@ instance_init(GTypeInstance *instance,
 		gst_pad_new_from_template(gst_element_class_get_pad_template(element_class, "sink"), "sink");
 
 	gst_pad_set_chain_function(self->sinkpad, pad_chain);
+	gst_pad_set_event_function(self->sinkpad, sink_event);
 
 	self->srcpad =
 		gst_pad_new_from_template(gst_element_class_get_pad_template(element_class, "src"), "src");
@@ -453,6 +712,16 @@ instance_init(GTypeInstance *instance,
 
 	gst_element_add_pad(GST_ELEMENT(self), self->sinkpad);
 	gst_element_add_pad(GST_ELEMENT(self), self->srcpad);
+
+	self->stats_mutex = g_mutex_new();
+}
+
+static void
+finalize(GObject *obj)
+{
+	GstDspDummy *self = GST_DSP_DUMMY(obj);
+	g_mutex_free(self->stats_mutex);
+	G_OBJECT_CLASS(parent_class)->finalize(obj);
 }
 
 static void
@@ -488,12 +757,38 @@ static void
 class_init(gpointer g_class,
 	   gpointer class_data)
 {
+	GObjectClass *gobject_class;
 	GstElementClass *gstelement_class;
 
 	parent_class = g_type_class_peek_parent(g_class);
+	gobject_class = G_OBJECT_CLASS(g_class);
 	gstelement_class = GST_ELEMENT_CLASS(g_class);
 
+	gobject_class->set_property = set_property;
+	gobject_class->get_property = get_property;
+	gobject_class->finalize = finalize;
+
 	gstelement_class->change_state = change_state;
+
+	g_object_class_install_property(gobject_class, ARG_BENCHMARK,
+					g_param_spec_boolean("benchmark", "Benchmark",
+							     "Measure the round-trip latency on own buffers, passing the input through",
+							     FALSE, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, ARG_IN_SIZE,
+					g_param_spec_uint("in-size", "Input size",
+							  "Benchmark payload sent to the DSP (0 = buffer size)",
+							  0, G_MAXUINT, 0, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, ARG_OUT_SIZE,
+					g_param_spec_uint("out-size", "Output size",
+							  "Benchmark payload from the DSP (0 = buffer size)",
+							  0, G_MAXUINT, 0, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, ARG_STATS,
+					g_param_spec_boxed("stats", "Statistics",
+							   "Benchmark latencies in microseconds and rates in MB/s",
+							   GST_TYPE_STRUCTURE, G_PARAM_READABLE));
 }
 
 GType
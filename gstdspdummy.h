@@ -24,6 +24,15 @@ typedef struct _GstDspDummyClass GstDspDummyClass;
 
 #include "dmm_buffer.h"
 
+#define DUMMY_SAMPLES 1024
+
+struct dummy_stats {
+	guint count;
+	guint64 min, max, total; /* us */
+	guint64 in_bytes, out_bytes;
+	guint64 samples[DUMMY_SAMPLES];
+};
+
 struct _GstDspDummy {
 	GstElement element;
 
@@ -36,6 +45,13 @@ struct _GstDspDummy {
 	dmm_buffer_t *in_buffer, *out_buffer;
 	struct dsp_notification *events[3];
 	unsigned dsp_error;
+
+	/* benchmark */
+	gboolean benchmark;
+	guint in_size, out_size;
+	dmm_buffer_t *bench_in, *bench_out;
+	struct dummy_stats stats;
+	GMutex *stats_mutex;
 };
 
 struct _GstDspDummyClass {
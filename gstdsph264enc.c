@@ -46,6 +46,7 @@ enum {
 #ifdef GST_DSP_ENABLE_DEPRECATED
 	ARG_BYTESTREAM,
 #endif
+	ARG_BUFFER_LIST,
 };
 
 static inline GstCaps *
@@ -115,6 +116,9 @@ set_property(GObject *obj,
 		self->priv.h264.bytestream = g_value_get_boolean(value);
 		break;
 #endif
+	case ARG_BUFFER_LIST:
+		self->priv.h264.buffer_list = g_value_get_boolean(value);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
 		break;
@@ -135,6 +139,9 @@ get_property(GObject *obj,
 		g_value_set_boolean(value, self->priv.h264.bytestream);
 		break;
 #endif
+	case ARG_BUFFER_LIST:
+		g_value_set_boolean(value, self->priv.h264.buffer_list);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
 		break;
@@ -157,6 +164,10 @@ class_init(gpointer g_class,
 					g_param_spec_boolean("bytestream", "BYTESTREAM", "bytestream",
 							     true, G_PARAM_READWRITE));
 #endif
+	g_object_class_install_property(gobject_class, ARG_BUFFER_LIST,
+			g_param_spec_boolean("buffer-list", "Buffer list",
+				"Push one buffer per NAL unit, in a buffer list (avc only)",
+				FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 GType
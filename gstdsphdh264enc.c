@@ -46,7 +46,8 @@ enum {
 	ARG_BYTESTREAM,
 #endif
 	ARG_SLICE_SIZE_MB,
-	ARG_IDR_INTERVAL
+	ARG_IDR_INTERVAL,
+	ARG_BUFFER_LIST,
 };
 
 static inline GstCaps *
@@ -125,6 +126,9 @@ set_property(GObject *obj,
 	case ARG_IDR_INTERVAL:
 		self->priv.h264.idr_interval = g_value_get_int(value);
 		break;
+	case ARG_BUFFER_LIST:
+		self->priv.h264.buffer_list = g_value_get_boolean(value);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
 		break;
@@ -151,6 +155,9 @@ get_property(GObject *obj,
 	case ARG_IDR_INTERVAL:
 		g_value_set_int(value, self->priv.h264.idr_interval);
 		break;
+	case ARG_BUFFER_LIST:
+		g_value_set_boolean(value, self->priv.h264.buffer_list);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
 		break;
@@ -183,6 +190,11 @@ class_init(gpointer g_class,
 			g_param_spec_int("idr-interval", "idr-interval",
 				"Generate IDR frames at every specified intervals (seconds)",
 				0, G_MAXINT, DEFAULT_IDR_INTERVAL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property(gobject_class, ARG_BUFFER_LIST,
+			g_param_spec_boolean("buffer-list", "Buffer list",
+				"Push one buffer per NAL unit, in a buffer list (avc only)",
+				FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 GType
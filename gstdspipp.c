@@ -13,6 +13,8 @@
 #include "gstdspipp.h"
 #include "util.h"
 
+#include <time.h>
+
 static GstDspBaseClass *parent_class;
 
 #define MAX_ALGS 16
@@ -35,9 +37,8 @@ static GstDspBaseClass *parent_class;
 #define INTERNAL_FORMAT IPP_YUV_420P
 #endif
 
-#define OVERWRITE_INPUT_BUFFER  1
-
 static bool send_stop_message(GstDspBase *base);
+static bool wait_frames(GstDspIpp *self);
 static gboolean sink_event(GstDspBase *base, GstEvent *event);
 static void send_processing_info_gstmessage(GstDspIpp *self, const gchar* info);
 static GstCaps *getcaps(GstPad * pad);
@@ -45,12 +46,28 @@ static GstCaps *getcaps(GstPad * pad);
 enum {
 	PROP_0,
 	PROP_NOISE_FILTER_STRENGTH,
+	PROP_STATS,
+	PROP_ALGORITHMS,
+	PROP_IN_PLACE,
 };
 
 enum {
 	NOISE_FILTER_CUSTOM,
 	NOISE_FILTER_NORMAL,
 	NOISE_FILTER_AGGRESSIVE,
+	NOISE_FILTER_OFF,
+};
+
+enum {
+	IN_PLACE_AUTO,
+	IN_PLACE_OFF,
+	IN_PLACE_ON,
+};
+
+/* optional stages of the chain */
+enum {
+	IPP_ALGO_CRCBS = 1 << 0,
+	IPP_ALGO_EENF = 1 << 1,
 };
 
 enum {
@@ -116,6 +133,36 @@ enum {
 	CONTENT_TYPE_OUT_ARGS,
 };
 
+/* per-frame message elements, preallocated in the arena */
+enum {
+	IPP_MSG_CONTROL_1,
+	IPP_MSG_CONTROL_2,
+	IPP_MSG_QUEUE, /* one per frame in flight */
+	IPP_MSG_FLUSH_1 = IPP_MSG_QUEUE + IPP_MAX_FRAMES, /* one per content type */
+	IPP_MSG_FLUSH_2 = IPP_MSG_FLUSH_1 + 3,
+	IPP_MSG_DYN_PARAMS = IPP_MSG_FLUSH_2 + 3,
+	IPP_MSG_STATUS,
+	IPP_MSG_NR,
+};
+
+#define IPP_MSG_ALIGN 128
+
+static const char *msg_names[] = {
+	[DFGM_CREATE_XBF] = "create-xbf",
+	[DFGM_DESTROY_XBF] = "destroy-xbf",
+	[DFGM_SET_XBF_ALGS] = "set-xbf-algs",
+	[DFGM_CLEAR_XBF_ALGS] = "clear-xbf-algs",
+	[DFGM_GET_MEM_REQ] = "get-mem-req",
+	[DFGM_CREATE_XBF_PIPE] = "create-xbf-pipe",
+	[DFGM_DESTROY_XBF_PIPE] = "destroy-xbf-pipe",
+	[DFGM_START_PROCESSING] = "start-processing",
+	[DFGM_STOP_PROCESSING] = "stop-processing",
+	[DFGM_QUEUE_BUFF] = "queue-buff",
+	[DFGM_CONTROL_PIPE] = "control-pipe",
+	[DFGM_FLUSH_PIPE] = "flush-pipe",
+	[DFGM_EXIT] = "exit",
+};
+
 struct ipp_name_string {
 	int8_t str[25];
 	uint32_t size;
@@ -131,6 +178,7 @@ gst_dsp_ipp_get_noise_filter_type(void)
 		{NOISE_FILTER_CUSTOM, "Custom", "custom"},
 		{NOISE_FILTER_NORMAL, "Normal", "normal"},
 		{NOISE_FILTER_AGGRESSIVE, "Aggressive", "aggressive"},
+		{NOISE_FILTER_OFF, "Off", "off"},
 		{0, NULL, NULL},
 	};
 
@@ -141,7 +189,48 @@ gst_dsp_ipp_get_noise_filter_type(void)
 	return gst_dspipp_strength_type;
 }
 
+#define GST_TYPE_IPP_ALGORITHMS (gst_dsp_ipp_get_algorithms_type())
+static GType
+gst_dsp_ipp_get_algorithms_type(void)
+{
+	static GType gst_dspipp_algorithms_type;
+
+	static GFlagsValue algorithms[] = {
+		{IPP_ALGO_CRCBS, "Chroma suppression", "crcbs"},
+		{IPP_ALGO_EENF, "Edge enhancement and noise filter", "eenf"},
+		{0, NULL, NULL},
+	};
+
+	if (G_UNLIKELY(!gst_dspipp_algorithms_type)) {
+		gst_dspipp_algorithms_type =
+				g_flags_register_static("GstDspIppAlgorithms", algorithms);
+	}
+	return gst_dspipp_algorithms_type;
+}
+
+#define GST_TYPE_IPP_IN_PLACE (gst_dsp_ipp_get_in_place_type())
+static GType
+gst_dsp_ipp_get_in_place_type(void)
+{
+	static GType gst_dspipp_in_place_type;
+
+	static GEnumValue in_place[] = {
+		{IN_PLACE_AUTO, "Automatic", "auto"},
+		{IN_PLACE_OFF, "Off", "off"},
+		{IN_PLACE_ON, "On", "on"},
+		{0, NULL, NULL},
+	};
+
+	if (G_UNLIKELY(!gst_dspipp_in_place_type)) {
+		gst_dspipp_in_place_type =
+				g_enum_register_static("GstDspIppInPlace", in_place);
+	}
+	return gst_dspipp_in_place_type;
+}
+
 #define DEFAULT_NOISE_FILTER_STRENGTH NOISE_FILTER_CUSTOM
+#define DEFAULT_ALGORITHMS (IPP_ALGO_CRCBS | IPP_ALGO_EENF)
+#define DEFAULT_IN_PLACE IN_PLACE_AUTO
 
 static inline dmm_buffer_t *ipp_calloc(GstDspIpp *self, size_t size, int dir)
 {
@@ -186,6 +275,7 @@ get_star_params(GstDspIpp *self)
 	dmm_buffer_map(tmp);
 
 	algo->create_params = tmp;
+	algo->name = "star";
 	algo->fxn = "STAR_ALG";
 
 	tmp = ipp_calloc(self, sizeof(*in_args), DMA_TO_DEVICE);
@@ -193,14 +283,14 @@ get_star_params(GstDspIpp *self)
 	in_args->size = sizeof(*in_args);
 	dmm_buffer_map(tmp);
 
-	algo->in = tmp;
+	algo->in[0] = tmp;
 
 	tmp = ipp_calloc(self, sizeof(*out_args), DMA_BIDIRECTIONAL);
 	out_args = tmp->data;
 	out_args->size = sizeof(*out_args);
 	dmm_buffer_map(tmp);
 
-	algo->out = tmp;
+	algo->out[0] = tmp;
 
 	return algo;
 }
@@ -252,6 +342,7 @@ get_yuvc_params(GstDspIpp *self, int in_fmt, int out_fmt)
 	dmm_buffer_map(tmp);
 
 	algo->create_params = tmp;
+	algo->name = out_fmt == IPP_YUV_422ILE ? "yuvc-out" : "yuvc-in";
 	algo->fxn = "YUVCONVERT_IYUVCONVERT";
 	algo->dma_fxn = "YUVCONVERT_TI_IDMA3";
 
@@ -266,14 +357,14 @@ get_yuvc_params(GstDspIpp *self, int in_fmt, int out_fmt)
 
 	dmm_buffer_map(tmp);
 
-	algo->in = tmp;
+	algo->in[0] = tmp;
 
 	tmp = ipp_calloc(self, sizeof(*out_args), DMA_BIDIRECTIONAL);
 	out_args = tmp->data;
 	out_args->size = sizeof(*out_args);
 	dmm_buffer_map(tmp);
 
-	algo->out = tmp;
+	algo->out[0] = tmp;
 
 	return algo;
 }
@@ -316,6 +407,7 @@ get_crcbs_params(GstDspIpp *self)
 	dmm_buffer_map(tmp);
 
 	algo->create_params = tmp;
+	algo->name = "crcbs";
 	algo->fxn = "CRCBS_ICRCBS";
 	algo->dma_fxn = "CRCBS_TI_IDMA3";
 
@@ -327,14 +419,14 @@ get_crcbs_params(GstDspIpp *self)
 	in_args->input_chroma_format = INTERNAL_FORMAT;
 	dmm_buffer_map(tmp);
 
-	algo->in = tmp;
+	algo->in[0] = tmp;
 
 	tmp = ipp_calloc(self, sizeof(*out_args), DMA_BIDIRECTIONAL);
 	out_args = tmp->data;
 	out_args->size = sizeof(*out_args);
 	dmm_buffer_map(tmp);
 
-	algo->out = tmp;
+	algo->out[0] = tmp;
 
 	return algo;
 }
@@ -391,6 +483,7 @@ get_eenf_params(GstDspIpp *self)
 	dmm_buffer_map(tmp);
 
 	algo->create_params = tmp;
+	algo->name = "eenf";
 	algo->fxn = "EENF_IEENF";
 	algo->dma_fxn = "EENF_TI_IDMA3";
 
@@ -404,127 +497,359 @@ get_eenf_params(GstDspIpp *self)
 	in_args->input_height = self->height;
 	dmm_buffer_map(tmp);
 
-	algo->in = tmp;
+	algo->in[0] = tmp;
 
 	tmp = ipp_calloc(self, sizeof(*out_args), DMA_BIDIRECTIONAL);
 	out_args = tmp->data;
 	out_args->size = sizeof(*out_args);
 	dmm_buffer_map(tmp);
 
-	algo->out = tmp;
+	algo->out[0] = tmp;
 
 	return algo;
 }
 
+static dmm_buffer_t *dup_args(GstDspIpp *self, dmm_buffer_t *b)
+{
+	dmm_buffer_t *tmp;
+
+	tmp = ipp_calloc(self, b->size, b->dir);
+	memcpy(tmp->data, b->data, b->size);
+	tmp->len = b->len;
+	dmm_buffer_map(tmp);
+
+	return tmp;
+}
+
+/*
+ * The star and the conversions are always there; the rest only when
+ * they are wanted, rather than running them with neutral parameters.
+ */
 static bool setup_ipp_params(GstDspIpp *self)
 {
+	unsigned j;
 	int i = 0;
 	self->algos[i++] = get_star_params(self);
 
 	if (self->in_pix_fmt != INTERNAL_FORMAT)
 		self->algos[i++] = get_yuvc_params(self, IPP_YUV_422ILE, INTERNAL_FORMAT);
 
-	self->algos[i++] = get_crcbs_params(self);
-	self->algos[i++] = get_eenf_params(self);
+	if (self->algorithms & IPP_ALGO_CRCBS)
+		self->algos[i++] = get_crcbs_params(self);
+
+	self->eenf_idx = -1;
+	if ((self->algorithms & IPP_ALGO_EENF) && self->eenf_strength != NOISE_FILTER_OFF) {
+		self->eenf_idx = i;
+		self->algos[i++] = get_eenf_params(self);
+	}
+
 	self->algos[i++] = get_yuvc_params(self, INTERNAL_FORMAT, IPP_YUV_422ILE);
 	self->nr_algos = i;
 
+	/* the DSP may still be on one frame while the next one is queued */
+	for (i = 0; i < (int) self->nr_algos; i++) {
+		struct ipp_algo *algo = self->algos[i];
+		for (j = 1; j < IPP_MAX_FRAMES; j++) {
+			algo->in[j] = dup_args(self, algo->in[0]);
+			algo->out[j] = dup_args(self, algo->out[0]);
+		}
+	}
+
+	pr_info(self, "%u algorithms, eenf %s", self->nr_algos,
+			self->eenf_idx >= 0 ? "on" : "off");
+
 	return true;
 }
 
-static void free_message_args(GstDspIpp *self)
+static inline bool is_msg_elem(GstDspIpp *self, dmm_buffer_t *b)
+{
+	return self->msg_elems &&
+		b >= self->msg_elems && b < self->msg_elems + IPP_MSG_NR;
+}
+
+static void free_message_args(GstDspIpp *self, struct ipp_msg *m)
 {
 	unsigned i;
 	dmm_buffer_t **c;
-	c = self->msg_ptr;
-	for (i = 0; i < ARRAY_SIZE(self->msg_ptr); i++, c++) {
-		dmm_buffer_free(*c);
+	c = m->args;
+	for (i = 0; i < ARRAY_SIZE(m->args); i++, c++) {
+		/* the arena is owned by the element */
+		if (!is_msg_elem(self, *c))
+			dmm_buffer_free(*c);
 		*c = NULL;
 	}
 }
 
-static void ipp_buffer_begin(GstDspIpp *self)
+static void ipp_buffer_begin(struct ipp_msg *m)
 {
 	unsigned i;
-	dmm_buffer_t **c = self->msg_ptr;
+	dmm_buffer_t **c = m->args;
 
-	for (i = 0; i < ARRAY_SIZE(self->msg_ptr); i++, c++) {
+	for (i = 0; i < ARRAY_SIZE(m->args); i++, c++) {
 		if (!*c)
 			continue;
 		dmm_buffer_begin(*c, (*c)->size);
 	}
 }
 
-static void ipp_buffer_end(GstDspIpp *self)
+static void ipp_buffer_end(struct ipp_msg *m)
 {
 	unsigned i;
-	dmm_buffer_t **c = self->msg_ptr;
+	dmm_buffer_t **c = m->args;
 
-	for (i = 0; i < ARRAY_SIZE(self->msg_ptr); i++, c++) {
+	for (i = 0; i < ARRAY_SIZE(m->args); i++, c++) {
 		if (!*c)
 			continue;
 		dmm_buffer_end(*c, (*c)->size);
 	}
 }
 
+static inline guint64 get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+/* called with msgs_mutex held */
+static void update_msg_stats(GstDspIpp *self, int id, guint64 start)
+{
+	struct ipp_msg_stats *stats = &self->msg_stats[id];
+	guint64 latency = get_time() - start;
+
+	stats->count++;
+	stats->total += latency;
+	if (latency > stats->max)
+		stats->max = latency;
+
+	pr_debug(self, "%s took %" G_GUINT64_FORMAT " us", msg_names[id], latency);
+}
+
 struct xbf_msg_elem_2 {
 	uint32_t size;
 	uint32_t error_code;
 };
 
-static void got_message(GstDspBase *base, struct dsp_msg *msg)
+struct control_pipe_msg_elem_2 {
+	uint32_t size;
+	uint32_t error_code;
+	struct {
+		uint32_t command_error_code;
+	} error_tables[MAX_ALGS];
+};
+
+/*
+ * All the out args start with the size and the error code. There's no
+ * timing in them, and the stages of a frame run back to back on the DSP
+ * without telling the host, so only whole frames can be timed. Called
+ * with msgs_mutex held.
+ */
+static void check_stage_errors(GstDspIpp *self, unsigned idx)
 {
-	GstDspIpp *self = GST_DSP_IPP(base);
-	int command_id = msg->cmd;
-	int error_code = 0;
-	dmm_buffer_t **msg_ptr = self->msg_ptr;
+	unsigned i;
 
-	ipp_buffer_end(self);
+	for (i = 0; i < self->nr_algos; i++) {
+		struct ipp_algo *algo = self->algos[i];
+		dmm_buffer_t *b = algo->out[idx];
+		int32_t error;
 
-	if (msg_ptr[1]) {
-		struct xbf_msg_elem_2 *msg_2;
-		msg_2 = msg_ptr[1]->data;
-		error_code = msg_2->error_code;
+		/* written by the DSP */
+		dmm_buffer_end(b, b->size);
+
+		error = ((int32_t *) b->data)[1];
+		algo->last_error = error;
+		if (!error)
+			continue;
+
+		algo->errors++;
+		pr_warning(self, "%s error 0x%x", algo->name, error);
 	}
+}
 
-	if (command_id == DFGM_FREE_BUFF) {
-		send_processing_info_gstmessage(self, "ipp-stop-processing");
-		du_port_t *p = base->ports[1];
-		struct td_buffer *tb;
+/*
+ * processing-time is from when the DSP could start on the frame; latency
+ * includes the time it waited behind the previous one.
+ */
+static void send_frame_stats(GstDspIpp *self, guint64 processing, guint64 latency)
+{
+	GstStructure *s;
+	GstMessage *msg;
+	unsigned i;
+
+	s = gst_structure_new("ipp-stop-processing",
+			"processing-time", G_TYPE_UINT64, processing,
+			"latency", G_TYPE_UINT64, latency,
+			NULL);
+
+	for (i = 0; i < self->nr_algos; i++) {
+		struct ipp_algo *algo = self->algos[i];
+		gchar *name;
+
+		name = g_strdup_printf("%s-error", algo->name);
+		gst_structure_set(s, name, G_TYPE_INT, algo->last_error, NULL);
+		g_free(name);
+	}
+
+	msg = gst_message_new_element(GST_OBJECT(self), s);
+
+	if (gst_element_post_message(GST_ELEMENT(self), msg) == FALSE)
+		pr_warning(self, "Element has no bus, no message sent");
+}
+
+/*
+ * The frames are processed in the order they were queued, and completed
+ * with DFGM_FREE_BUFF.
+ */
+static void complete_frame(GstDspIpp *self)
+{
+	GstDspBase *base = GST_DSP_BASE(self);
+	struct ipp_frame frame;
+	dmm_buffer_t *b;
+	du_port_t *p;
+	struct td_buffer *tb;
+	unsigned idx;
+	bool idle;
+	guint64 now, start;
+
+	g_mutex_lock(self->frames_mutex);
+	if (!self->nr_frames) {
+		g_mutex_unlock(self->frames_mutex);
+		pr_warning(self, "unexpected buffer release");
+		return;
+	}
+	idx = self->frame_pos;
+	frame = self->frames[idx];
+	g_mutex_unlock(self->frames_mutex);
+
+	/* read everything back before the slot can be queued again */
+	b = &self->msg_elems[IPP_MSG_QUEUE + idx];
+	dmm_buffer_end(b, b->size);
+
+	g_mutex_lock(self->msgs_mutex);
+	update_msg_stats(self, DFGM_QUEUE_BUFF, frame.start);
+	check_stage_errors(self, idx);
+	g_mutex_unlock(self->msgs_mutex);
+
+	g_mutex_lock(self->frames_mutex);
+	self->frame_pos = (idx + 1) % IPP_MAX_FRAMES;
+	idle = --self->nr_frames == 0;
+	g_mutex_unlock(self->frames_mutex);
+
+	/* a frame queued behind another only starts when that one is done */
+	now = get_time();
+	start = MAX(frame.start, self->last_done);
+	self->last_done = now;
+
+	send_frame_stats(self, now - start, now - frame.start);
+
+	p = base->ports[1];
+
+	if (self->in_place) {
+		dmm_buffer_t *b = frame.src;
+		dmm_buffer_end(b, b->len);
+		/* mapped for the DSP to read, but the results are there */
+		if (b->dir == DMA_TO_DEVICE && (self->nr_algos & 0x01))
+			dsp_invalidate(b->handle, b->proc, b->data, base->output_buffer_size);
+	}
 
-#ifdef OVERWRITE_INPUT_BUFFER
-		if (self->nr_algos & 0x01) {
-			/* so, output has ended up in input */
-			/* expect to find input buffer ref here */
-			g_assert(self->in_buf_ptr->user_data);
+	if (self->in_place && (self->nr_algos & 0x01)) {
+		/* so, output has ended up in input */
+		if (frame.in->user_data) {
 			/* hand it over to the output, which should have no ref there,
 			 * output_loop will pick it up and push downstream */
-			g_assert(self->out_buf_ptr->user_data == NULL);
-			self->out_buf_ptr->user_data = self->in_buf_ptr->user_data;
-			self->in_buf_ptr->user_data = NULL;
+			g_assert(frame.out->user_data == NULL);
+			frame.out->user_data = frame.in->user_data;
+			frame.in->user_data = NULL;
 			/* arrange for output_loop to send it back to us at once */
-			self->out_buf_ptr->pinned = FALSE;
-			tb = self->out_buf_ptr;
-		}
-#endif
-		tb = self->out_buf_ptr;
-		tb->data->len = base->output_buffer_size;
-		async_queue_push(p->queue, tb);
-
-		/* push buffer into input queue */
-		p = base->ports[0];
-		tb = self->in_buf_ptr;
-		/* NOTE needed, but does not go well with overwrite input */
-		if (tb->user_data) {
-			gst_buffer_unref(tb->user_data);
-			tb->user_data = NULL;
+			frame.out->pinned = FALSE;
+		} else {
+			/* our own memory; nothing to hand over */
+			pr_info(self, "copy");
+			memcpy(frame.out->data->data, frame.src->data,
+					base->output_buffer_size);
 		}
-		async_queue_push(p->queue, tb);
+	}
+
+	tb = frame.out;
+	tb->data->len = base->output_buffer_size;
+	async_queue_push(p->queue, tb);
+
+	/* push buffer into input queue */
+	p = base->ports[0];
+	tb = frame.in;
+	/* NOTE needed, but does not go well with overwrite input */
+	if (tb->user_data) {
+		gst_buffer_unref(tb->user_data);
+		tb->user_data = NULL;
+	}
+	async_queue_push(p->queue, tb);
 
-		/* keep possible intermediate buffer around for re-use */
+	/* keep possible intermediate buffer around for re-use */
 
-		/* signal processing finished */
+	/* signal processing finished */
+	if (idle)
 		g_sem_up(self->sync_sem);
+}
+
+static void check_control_errors(GstDspIpp *self, dmm_buffer_t *b)
+{
+	struct control_pipe_msg_elem_2 *msg_2 = b->data;
+	unsigned i;
+
+	g_mutex_lock(self->msgs_mutex);
+	for (i = 0; i < self->nr_algos; i++) {
+		struct ipp_algo *algo = self->algos[i];
+		uint32_t error = msg_2->error_tables[i].command_error_code;
+
+		if (!error)
+			continue;
+
+		algo->control_errors++;
+		pr_warning(self, "%s control error 0x%x", algo->name, error);
+	}
+	g_mutex_unlock(self->msgs_mutex);
+}
+
+static void got_message(GstDspBase *base, struct dsp_msg *msg)
+{
+	GstDspIpp *self = GST_DSP_IPP(base);
+	int command_id = msg->cmd;
+	int error_code = 0;
+	struct ipp_msg m;
+	unsigned i;
+
+	/* not acknowledgements; the other messages are still pending */
+	switch (command_id) {
+	case DFGM_FREE_BUFF:
+		complete_frame(self);
+		return;
+	case DFGM_EVENT_ERROR:
+		gstdsp_got_error(base, -1, "DFGM Event Error");
+		base->done = TRUE;
+		return;
+	default:
+		break;
+	}
+
+	/* the acknowledgements come in order */
+	g_mutex_lock(self->msgs_mutex);
+	if (!self->nr_msgs) {
+		g_mutex_unlock(self->msgs_mutex);
+		pr_warning(self, "unexpected command 0x%x", command_id);
+		return;
+	}
+	m = self->msgs[self->msg_pos];
+	self->msg_pos = (self->msg_pos + 1) % IPP_MAX_MSGS;
+	self->nr_msgs--;
+	update_msg_stats(self, m.id, m.start);
+	g_mutex_unlock(self->msgs_mutex);
+
+	ipp_buffer_end(&m);
+
+	if (m.args[1]) {
+		struct xbf_msg_elem_2 *msg_2;
+		msg_2 = m.args[1]->data;
+		error_code = msg_2->error_code;
 	}
 
 	switch (command_id) {
@@ -536,18 +861,18 @@ static void got_message(GstDspBase *base, struct dsp_msg *msg)
 	case DFGM_CLEAR_XBF_ALGS_ACK:
 	case DFGM_DESTROY_XBF_PIPE_ACK:
 	case DFGM_START_PROCESSING_ACK:
-	case DFGM_FREE_BUFF:
-	case DFGM_CONTROL_PIPE_ACK:
 	case DFGM_FLUSH_PIPE_ACK:
-		free_message_args(self);
+		free_message_args(self, &m);
 		break;
-	case DFGM_EVENT_ERROR:
-		free_message_args(self);
-		gstdsp_got_error(base, -1, "DFGM Event Error");
-		base->done = TRUE;
+	case DFGM_CONTROL_PIPE_ACK:
+		for (i = IPP_MSG_DYN_PARAMS; i <= IPP_MSG_STATUS; i++)
+			dmm_buffer_end(&self->msg_elems[i], self->msg_elems[i].size);
+		check_control_errors(self, m.args[1]);
+		free_message_args(self, &m);
 		break;
 	default:
 		pr_warning(self, "unhandled command 0x%x", command_id);
+		free_message_args(self, &m);
 		break;
 	}
 
@@ -571,32 +896,80 @@ static void got_message(GstDspBase *base, struct dsp_msg *msg)
 	g_sem_up(self->msg_sem);
 }
 
-static bool send_msg(GstDspIpp *self, int id,
+/*
+ * Post a message without waiting for the previous ones to be
+ * acknowledged; at most IPP_MAX_MSGS can be pending.
+ */
+static bool post_msg(GstDspIpp *self, int id,
 		     dmm_buffer_t *arg1,
 		     dmm_buffer_t *arg2,
 		     dmm_buffer_t *arg3)
 {
 	GstDspBase *base = GST_DSP_BASE(self);
+	struct ipp_msg *m;
 
 	if (!g_sem_down_timed(self->msg_sem, IPP_TIMEOUT)) {
 		pr_err(self, "ipp send msg timed out");
 		return false;
 	}
 
-	self->msg_ptr[0] = arg1;
-	self->msg_ptr[1] = arg2;
-	self->msg_ptr[2] = arg3;
-
-	ipp_buffer_begin(self);
-
-	if (id == DFGM_QUEUE_BUFF)
-		send_processing_info_gstmessage(self, "ipp-start-processing");
+	g_mutex_lock(self->msgs_mutex);
+	m = &self->msgs[(self->msg_pos + self->nr_msgs) % IPP_MAX_MSGS];
+	m->id = id;
+	m->args[0] = arg1;
+	m->args[1] = arg2;
+	m->args[2] = arg3;
+	m->start = get_time();
+	self->nr_msgs++;
+	ipp_buffer_begin(m);
+	g_mutex_unlock(self->msgs_mutex);
 
 	return dsp_send_message(base->dsp_handle, base->node, id,
 				arg1 ? (uint32_t)arg1->map : 0,
 				arg2 ? (uint32_t)arg2->map : 0);
 }
 
+/* wait for all the pending messages to be acknowledged */
+static bool wait_msgs(GstDspIpp *self)
+{
+	unsigned i, j;
+	bool ok = true;
+
+	for (i = 0; i < IPP_MAX_MSGS; i++) {
+		if (!g_sem_down_timed(self->msg_sem, IPP_TIMEOUT)) {
+			pr_err(self, "ipp send msg timed out");
+			ok = false;
+			break;
+		}
+	}
+
+	for (j = 0; j < i; j++)
+		g_sem_up(self->msg_sem);
+
+	return ok;
+}
+
+static bool send_msg(GstDspIpp *self, int id,
+		     dmm_buffer_t *arg1,
+		     dmm_buffer_t *arg2,
+		     dmm_buffer_t *arg3)
+{
+	if (!wait_msgs(self))
+		return false;
+
+	return post_msg(self, id, arg1, arg2, arg3);
+}
+
+static dmm_buffer_t *get_msg_elem(GstDspIpp *self, int id, size_t size)
+{
+	dmm_buffer_t *b = &self->msg_elems[id];
+
+	memset(b->data, 0, b->size);
+	b->len = size;
+
+	return b;
+}
+
 static dmm_buffer_t *get_msg_2(GstDspIpp *self)
 {
 	struct xbf_msg_elem_2 *msg_2;
@@ -750,33 +1123,33 @@ static void prepare_filter_graph(GstDspIpp *self)
 	for (i = 0; i < nr_algos - 1; i++)
 		*flt_graph->graph_connection[i][i + 1].n = 0;
 
-#ifdef OVERWRITE_INPUT_BUFFER
-	/*
-	 * Star ports:
-	 * 0: input
-	 * 1: output
-	 *
-	 * Input buffer is also used for processing.Use above ports alternatively,
-	 * and the first one should always be 1.
-	 */
-	for (i = 0; i < nr_algos - 1; i++) {
-		*flt_graph->output_buf_distribution[i + 1].n = port;
-		port = !port;
-	}
-#else
-	/*
-	 * Star ports:
-	 * 1: output
-	 * 2: intermediate
-	 *
-	 * Use these alternatively, and the last one in the pipeline should
-	 * always be 1.
-	 */
-	for (i = nr_algos - 1; i >= 1; i--) {
-		*flt_graph->output_buf_distribution[i].n = port;
-		port = !(port - 1) + 1;
+	if (self->in_place) {
+		/*
+		 * Star ports:
+		 * 0: input
+		 * 1: output
+		 *
+		 * Input buffer is also used for processing.Use above ports alternatively,
+		 * and the first one should always be 1.
+		 */
+		for (i = 0; i < nr_algos - 1; i++) {
+			*flt_graph->output_buf_distribution[i + 1].n = port;
+			port = !port;
+		}
+	} else {
+		/*
+		 * Star ports:
+		 * 1: output
+		 * 2: intermediate
+		 *
+		 * Use these alternatively, and the last one in the pipeline should
+		 * always be 1.
+		 */
+		for (i = nr_algos - 1; i >= 1; i--) {
+			*flt_graph->output_buf_distribution[i].n = port;
+			port = !(port - 1) + 1;
+		}
 	}
-#endif
 
 	dmm_buffer_map(self->flt_graph);
 }
@@ -816,11 +1189,10 @@ static bool create_pipe(GstDspIpp *self)
 	arg_1->create_params_array_ptr = (uint32_t)b_create_params->map;
 	arg_1->num_create_params = nr_algos;
 
-#ifdef OVERWRITE_INPUT_BUFFER
-	arg_1->num_in_port = 2;
-#else
-	arg_1->num_in_port = (nr_algos == 2) ? 2 : 3;
-#endif
+	if (self->in_place)
+		arg_1->num_in_port = 2;
+	else
+		arg_1->num_in_port = (nr_algos == 2) ? 2 : 3;
 
 	dmm_buffer_map(b_arg_1);
 
@@ -842,38 +1214,60 @@ struct flush_pipe_msg_elem_1 {
 static bool flush_pipe(GstDspIpp *self, int content_type)
 {
 	struct flush_pipe_msg_elem_1 *msg_1;
+	struct xbf_msg_elem_2 *msg_2;
 	dmm_buffer_t *b_arg_1;
+	dmm_buffer_t *b_arg_2;
 
-	b_arg_1 = ipp_calloc(self, sizeof(*msg_1), DMA_TO_DEVICE);
+	b_arg_1 = get_msg_elem(self, IPP_MSG_FLUSH_1 + content_type, sizeof(*msg_1));
 	msg_1 = b_arg_1->data;
 	msg_1->size = sizeof(*msg_1);
 	msg_1->content_type = content_type;
 	msg_1->num_buffer_port = -1;
 	msg_1->num_arg_port = -1;
-	dmm_buffer_map(b_arg_1);
 
-	return send_msg(self, DFGM_FLUSH_PIPE, b_arg_1, get_msg_2(self), NULL);
+	b_arg_2 = get_msg_elem(self, IPP_MSG_FLUSH_2 + content_type, sizeof(*msg_2));
+	msg_2 = b_arg_2->data;
+	msg_2->size = sizeof(*msg_2);
+
+	return post_msg(self, DFGM_FLUSH_PIPE, b_arg_1, b_arg_2, NULL);
 }
 
+/*
+ * All three go back-to-back; the acknowledgements are collected in the
+ * background, only the previous batch has to be done with the elements.
+ */
 static bool flush_queue_buffer(GstDspIpp *self)
 {
 	bool ok;
 
-	ok = flush_pipe(self, CONTENT_TYPE_BUFFER);
+	ok = wait_msgs(self);
 	if (!ok)
 		return ok;
 
-	ok = flush_pipe(self, CONTENT_TYPE_IN_ARGS);
+	ok = flush_pipe(self, CONTENT_TYPE_BUFFER);
 	if (!ok)
 		return ok;
 
-	ok = flush_pipe(self, CONTENT_TYPE_OUT_ARGS);
+	ok = flush_pipe(self, CONTENT_TYPE_IN_ARGS);
 	if (!ok)
 		return ok;
 
-	return TRUE;
+	return flush_pipe(self, CONTENT_TYPE_OUT_ARGS);
 }
 
+struct algo_buf_info {
+	uint32_t min_num_in_bufs;
+	uint32_t min_num_out_bufs;
+	uint32_t min_in_buf_size[MAX_ALGS];
+	uint32_t min_out_buf_size[MAX_ALGS];
+};
+
+struct algo_status {
+	uint32_t status;
+	uint32_t extended_error;
+	struct algo_buf_info bufInfo;
+};
+
 struct control_pipe_msg_elem_1 {
 	uint32_t size;
 	struct {
@@ -884,14 +1278,6 @@ struct control_pipe_msg_elem_1 {
 	} control_tables[MAX_ALGS];
 };
 
-struct control_pipe_msg_elem_2 {
-	uint32_t size;
-	uint32_t error_code;
-	struct {
-		uint32_t command_error_code;
-	} error_tables[MAX_ALGS];
-};
-
 static bool control_pipe(GstDspIpp *self)
 {
 	struct control_pipe_msg_elem_1 *msg_1;
@@ -900,20 +1286,9 @@ static bool control_pipe(GstDspIpp *self)
 	dmm_buffer_t *b_msg_2;
 	size_t tbl_size;
 	int i;
-	int eenf_idx;
 	int nr_algos = self->nr_algos;
 
-	/*
-	 * If the input format is YUV420p, YUV422i to YUV420p conversion
-	 * algorithm will not present in the ipp pipeline. In that case
-	 * position of eenf in the pipeline is 2. Otherwise eenf positiom is 3.
-	 */
-	if (self->in_pix_fmt == INTERNAL_FORMAT)
-		eenf_idx = 2;
-	else
-		eenf_idx = 3;
-
-	b_msg_1 = ipp_calloc(self, sizeof(*msg_1), DMA_TO_DEVICE);
+	b_msg_1 = get_msg_elem(self, IPP_MSG_CONTROL_1, sizeof(*msg_1));
 	msg_1 = b_msg_1->data;
 	tbl_size = (sizeof(msg_1->control_tables) / MAX_ALGS) * nr_algos;
 	msg_1->size = sizeof(uint32_t) + tbl_size;
@@ -922,20 +1297,17 @@ static bool control_pipe(GstDspIpp *self)
 		msg_1->control_tables[i].alg_inst = i;
 		msg_1->control_tables[i].control_cmd = -1;
 
-		if (i == eenf_idx) {
+		if (i == self->eenf_idx) {
 			msg_1->control_tables[i].control_cmd = 1;
-			msg_1->control_tables[i].dyn_params_ptr = (uint32_t)self->dyn_params->map;
-			msg_1->control_tables[i].status_ptr = (uint32_t)self->status_params->map;
+			msg_1->control_tables[i].dyn_params_ptr = (uint32_t)self->msg_elems[IPP_MSG_DYN_PARAMS].map;
+			msg_1->control_tables[i].status_ptr = (uint32_t)self->msg_elems[IPP_MSG_STATUS].map;
 		}
 	}
 
-	dmm_buffer_map(b_msg_1);
-
-	b_msg_2 = ipp_calloc(self, sizeof(*msg_2), DMA_BIDIRECTIONAL);
+	b_msg_2 = get_msg_elem(self, IPP_MSG_CONTROL_2, sizeof(*msg_2));
 	msg_2 = b_msg_2->data;
 	tbl_size = (sizeof(msg_2->error_tables) / MAX_ALGS) * nr_algos;
 	msg_2->size = 2 * sizeof(uint32_t) + tbl_size;
-	dmm_buffer_map(b_msg_2);
 
 	return send_msg(self, DFGM_CONTROL_PIPE, b_msg_1, b_msg_2, NULL);
 }
@@ -953,28 +1325,29 @@ struct queue_buff_msg_elem_1 {
 	uint32_t next_content_ptr;
 };
 
-static bool queue_buffer(GstDspIpp *self, struct td_buffer *tb, struct td_buffer *otb)
+static bool queue_buffer(GstDspIpp *self, unsigned idx)
 {
 	GstDspBase *base = GST_DSP_BASE(self);
 	struct queue_buff_msg_elem_1 *queue_msg1;
 	struct queue_buff_msg_elem_1 *msg_elem_list;
 	dmm_buffer_t *msg_elem_array;
+	struct td_buffer *otb;
 	int32_t cur_idx = 0;
 	int i = 0;
 	int nr_algos = self->nr_algos;
 	int nr_buffers;
 	int nr_msgs;
 
-#ifdef OVERWRITE_INPUT_BUFFER
-	nr_buffers = 2;
-#else
-	nr_buffers = (nr_algos == 2) ? 2 : 3;
-#endif
+	if (self->in_place)
+		nr_buffers = 2;
+	else
+		nr_buffers = (nr_algos == 2) ? 2 : 3;
+
+	otb = self->frames[idx].out;
 
 	nr_msgs = nr_algos * 2 + nr_buffers;
-	msg_elem_array = ipp_calloc(self, nr_msgs * sizeof(*msg_elem_list), DMA_BIDIRECTIONAL);
+	msg_elem_array = get_msg_elem(self, IPP_MSG_QUEUE + idx, nr_msgs * sizeof(*msg_elem_list));
 	msg_elem_list = msg_elem_array->data;
-	dmm_buffer_map(msg_elem_array);
 
 	queue_msg1 = &msg_elem_list[cur_idx];
 
@@ -984,31 +1357,27 @@ static bool queue_buffer(GstDspIpp *self, struct td_buffer *tb, struct td_buffer
 		queue_msg1->port_num = i;
 		queue_msg1->reuse_allowed_flag = 0;
 		if (i == 0) {
-			self->in_buf_ptr = tb;
 			queue_msg1->content_size_used = base->input_buffer_size;
 			queue_msg1->content_size = base->input_buffer_size;
-			queue_msg1->content_ptr = (uint32_t)tb->data->map;
+			queue_msg1->content_ptr = (uint32_t)self->frames[idx].src->map;
 		} else if (i == 1) {
-			dmm_buffer_map(otb->data);
-			self->out_buf_ptr = otb;
+			/* pinned; mapped since the port was set up */
 			queue_msg1->content_size_used = base->output_buffer_size;
 			queue_msg1->content_size = base->output_buffer_size;
-			queue_msg1->content_ptr = (uint32_t)self->out_buf_ptr->data->map;
+			queue_msg1->content_ptr = (uint32_t)otb->data->map;
 		} else {
-			dmm_buffer_t *b = NULL;
-
-			if (self->intermediate_buf) {
-				if (self->intermediate_buf->size >= base->input_buffer_size) {
-					pr_debug(self, "re-using intermediate buffer");
-					b = self->intermediate_buf;
-				} else
-					dmm_buffer_free(self->intermediate_buf);
+			struct ipp_frame *frame = &self->frames[idx];
+			dmm_buffer_t *b = frame->intermediate;
+
+			if (b && b->size < base->input_buffer_size) {
+				dmm_buffer_free(b);
+				b = NULL;
 			}
 			if (!b) {
-				pr_debug(self, "setting up intermediate buffer");
+				pr_debug(self, "setting up intermediate buffer %u", idx);
 				b = ipp_calloc(self, base->input_buffer_size, DMA_FROM_DEVICE);
 				dmm_buffer_map(b);
-				self->intermediate_buf = b;
+				frame->intermediate = b;
 			}
 			queue_msg1->content_size_used = base->input_buffer_size;
 			queue_msg1->content_size = base->input_buffer_size;
@@ -1024,9 +1393,9 @@ static bool queue_buffer(GstDspIpp *self, struct td_buffer *tb, struct td_buffer
 		queue_msg1->size = sizeof(*queue_msg1);
 		queue_msg1->content_type = CONTENT_TYPE_IN_ARGS;
 		queue_msg1->algo_index = i;
-		queue_msg1->content_size_used = self->algos[i]->in->len;
+		queue_msg1->content_size_used = self->algos[i]->in[idx]->len;
 		queue_msg1->content_size = queue_msg1->content_size_used;
-		queue_msg1->content_ptr = (uint32_t)self->algos[i]->in->map;
+		queue_msg1->content_ptr = (uint32_t)self->algos[i]->in[idx]->map;
 		cur_idx++;
 		queue_msg1->next_content_ptr = (uint32_t)((char *)msg_elem_array->map) +
 			(cur_idx)*sizeof(*msg_elem_list);
@@ -1037,9 +1406,9 @@ static bool queue_buffer(GstDspIpp *self, struct td_buffer *tb, struct td_buffer
 		queue_msg1->size = sizeof(*queue_msg1);
 		queue_msg1->content_type = CONTENT_TYPE_OUT_ARGS;
 		queue_msg1->algo_index = i;
-		queue_msg1->content_size_used = self->algos[i]->out->len;
+		queue_msg1->content_size_used = self->algos[i]->out[idx]->len;
 		queue_msg1->content_size = queue_msg1->content_size_used;
-		queue_msg1->content_ptr = (uint32_t)self->algos[i]->out->map;
+		queue_msg1->content_ptr = (uint32_t)self->algos[i]->out[idx]->map;
 		cur_idx++;
 
 		if (i == nr_algos - 1) {
@@ -1051,7 +1420,16 @@ static bool queue_buffer(GstDspIpp *self, struct td_buffer *tb, struct td_buffer
 		}
 	}
 
-	return send_msg(self, DFGM_QUEUE_BUFF, msg_elem_array, NULL, NULL);
+	/*
+	 * There's no acknowledgement for this one, so it doesn't go through
+	 * send_msg(); the frame is completed with DFGM_FREE_BUFF.
+	 */
+	dmm_buffer_begin(msg_elem_array, msg_elem_array->size);
+
+	send_processing_info_gstmessage(self, "ipp-start-processing");
+
+	return dsp_send_message(base->dsp_handle, base->node, DFGM_QUEUE_BUFF,
+				(uint32_t)msg_elem_array->map, 0);
 }
 
 struct stop_processing_msg_elem_1 {
@@ -1101,11 +1479,66 @@ static bool destroy_xbf(GstDspIpp *self)
 	return send_msg(self, DFGM_DESTROY_XBF, b_arg_1, get_msg_2(self), NULL);
 }
 
+/*
+ * All the message elements used for every frame live in a single buffer
+ * that is mapped once; only the cache maintenance is done per message.
+ */
+static void setup_msg_arena(GstDspIpp *self)
+{
+	size_t sizes[IPP_MSG_NR];
+	size_t offset = 0;
+	dmm_buffer_t *arena;
+	unsigned i;
+
+	sizes[IPP_MSG_CONTROL_1] = sizeof(struct control_pipe_msg_elem_1);
+	sizes[IPP_MSG_CONTROL_2] = sizeof(struct control_pipe_msg_elem_2);
+	sizes[IPP_MSG_QUEUE] = (MAX_ALGS * 2 + 3) * sizeof(struct queue_buff_msg_elem_1);
+	for (i = 0; i < 3; i++) {
+		sizes[IPP_MSG_FLUSH_1 + i] = sizeof(struct flush_pipe_msg_elem_1);
+		sizes[IPP_MSG_FLUSH_2 + i] = sizeof(struct xbf_msg_elem_2);
+	}
+	sizes[IPP_MSG_DYN_PARAMS] = sizeof(struct ipp_eenf_params);
+	sizes[IPP_MSG_STATUS] = sizeof(struct algo_status);
+
+	for (i = 0; i < IPP_MSG_NR; i++)
+		offset += ROUND_UP(sizes[i], IPP_MSG_ALIGN);
+
+	arena = ipp_calloc(self, offset, DMA_BIDIRECTIONAL);
+	dmm_buffer_map(arena);
+	self->msg_arena = arena;
+
+	self->msg_elems = calloc(IPP_MSG_NR, sizeof(*self->msg_elems));
+
+	offset = 0;
+	for (i = 0; i < IPP_MSG_NR; i++) {
+		dmm_buffer_t *b = &self->msg_elems[i];
+
+		b->handle = arena->handle;
+		b->proc = arena->proc;
+		b->dir = DMA_BIDIRECTIONAL;
+		b->data = (char *) arena->data + offset;
+		b->map = (char *) arena->map + offset;
+		b->size = b->len = sizes[i];
+
+		offset += ROUND_UP(sizes[i], IPP_MSG_ALIGN);
+	}
+}
+
+static void free_msg_arena(GstDspIpp *self)
+{
+	free(self->msg_elems);
+	self->msg_elems = NULL;
+	dmm_buffer_free(self->msg_arena);
+	self->msg_arena = NULL;
+}
+
 static bool init_pipe(GstDspBase *base)
 {
 	GstDspIpp *self = GST_DSP_IPP(base);
 	bool ok;
 
+	setup_msg_arena(self);
+
 	ok = create_xbf(self);
 	if (!ok)
 		goto leave;
@@ -1127,19 +1560,6 @@ leave:
 
 /* Dynamic parameters for eenf */
 
-struct algo_buf_info {
-	uint32_t min_num_in_bufs;
-	uint32_t min_num_out_bufs;
-	uint32_t min_in_buf_size[MAX_ALGS];
-	uint32_t min_out_buf_size[MAX_ALGS];
-};
-
-struct algo_status {
-	uint32_t status;
-	uint32_t extended_error;
-	struct algo_buf_info bufInfo;
-};
-
 static struct ipp_eenf_params eenf_normal = {
 	.edge_enhancement_strength = 110,
 	.weak_edge_threshold = 30,
@@ -1186,12 +1606,11 @@ static struct ipp_eenf_params eenf_aggressive = {
 	.ratio_downsample_cb_cr = 4,
 };
 
-static void
+static bool
 get_eenf_dyn_params(GstDspIpp *self)
 {
-	dmm_buffer_t *tmp;
-	size_t size;
 	struct ipp_eenf_params *params;
+	dmm_buffer_t *dyn_params, *status;
 
 	switch (self->eenf_strength) {
 	case NOISE_FILTER_CUSTOM:
@@ -1207,30 +1626,132 @@ get_eenf_dyn_params(GstDspIpp *self)
 		params = &eenf_aggressive;
 		break;
 	default:
-		return;
+		return true;
 	}
 
+	/* the previous control message might still be using them */
+	if (!wait_msgs(self))
+		return false;
+
 	params->size = sizeof(*params);
 	params->in_place = 0;
 
-	if (self->dyn_params) {
-		dmm_buffer_free(self->dyn_params);
-		self->dyn_params = NULL;
+	dyn_params = get_msg_elem(self, IPP_MSG_DYN_PARAMS, sizeof(*params));
+	memcpy(dyn_params->data, params, sizeof(*params));
+	dmm_buffer_begin(dyn_params, dyn_params->size);
+
+	status = get_msg_elem(self, IPP_MSG_STATUS, sizeof(struct algo_status));
+	dmm_buffer_begin(status, status->size);
+
+	return true;
+}
+
+/*
+ * Processing in place saves the intermediate buffer, but the DSP writes
+ * into the input buffer, so only do it when upstream doesn't need it. In
+ * auto mode that's only known once the buffers come; see leave_in_place().
+ */
+static void choose_in_place(GstDspIpp *self)
+{
+	GstDspBase *base = GST_DSP_BASE(self);
+
+	self->in_place = self->in_place_mode != IN_PLACE_OFF;
+
+	/* the intermediate results are as big as the output */
+	if (self->in_place && base->input_buffer_size < base->output_buffer_size) {
+		if (self->in_place_mode == IN_PLACE_ON)
+			pr_warning(self, "input too small for in-place processing");
+		self->in_place = false;
 	}
 
-	if (self->status_params) {
-		dmm_buffer_free(self->status_params);
-		self->status_params = NULL;
+	pr_info(self, "in-place processing: %s", self->in_place ? "yes" : "no");
+}
+
+static void pre_process_buffer(GstDspBase *base, GstBuffer *buf)
+{
+	GstDspIpp *self = GST_DSP_IPP(base);
+
+	self->in_writable = gst_buffer_is_writable(buf);
+}
+
+/*
+ * The input is mapped for the DSP to read, so upstream buffers of any
+ * alignment are used as they are. In place the DSP writes into it, so when
+ * that's forced, a buffer upstream still holds is first copied to the frame
+ * slot's own bounce buffer, which is allocated once.
+ */
+static dmm_buffer_t *get_input(GstDspIpp *self, unsigned idx)
+{
+	GstDspBase *base = GST_DSP_BASE(self);
+	struct ipp_frame *frame = &self->frames[idx];
+	struct td_buffer *tb = frame->in;
+	GstBuffer *buf = tb->user_data;
+	dmm_buffer_t *b;
+	size_t size;
+
+	if (!self->in_place || !buf || self->in_writable) {
+		b = tb->data;
+		dmm_buffer_map(b);
+		if (self->in_place)
+			dmm_buffer_begin(b, b->len);
+		return b;
 	}
 
-	tmp = ipp_calloc(self, sizeof(*params), DMA_TO_DEVICE);
-	memcpy(tmp->data, params, sizeof(*params));
-	dmm_buffer_map(tmp);
-	self->dyn_params = tmp;
+	size = MAX(GST_BUFFER_SIZE(buf), base->input_buffer_size);
+	b = frame->bounce;
+	if (!b || b->size < size) {
+		dmm_buffer_free(b);
+		pr_debug(self, "setting up bounce buffer %u", idx);
+		b = ipp_calloc(self, size, DMA_BIDIRECTIONAL);
+		dmm_buffer_map(b);
+		frame->bounce = b;
+	}
+
+	pr_debug(self, "input not writable, copy");
+	memcpy(b->data, GST_BUFFER_DATA(buf), GST_BUFFER_SIZE(buf));
+	b->len = GST_BUFFER_SIZE(buf);
+	dmm_buffer_begin(b, b->len);
+
+	gst_buffer_unref(buf);
+	tb->user_data = NULL;
 
-	size = sizeof(struct algo_status);
-	self->status_params = ipp_calloc(self, size, DMA_BIDIRECTIONAL);
-	dmm_buffer_map(self->status_params);
+	return b;
+}
+
+/*
+ * Upstream holds on to its buffers (e.g. a camera), so in place every frame
+ * would need a copy; rebuild the pipe with the intermediate buffer instead,
+ * for the rest of the stream.
+ */
+static bool leave_in_place(GstDspIpp *self)
+{
+	bool ok;
+
+	pr_info(self, "input not writable, no in-place processing");
+
+	ok = wait_frames(self);
+	if (!ok)
+		return ok;
+
+	ok = stop_processing(self);
+	if (!ok)
+		return ok;
+
+	ok = destroy_pipe(self);
+	if (!ok)
+		return ok;
+
+	self->in_place = false;
+	dmm_buffer_free(self->flt_graph);
+	prepare_filter_graph(self);
+	/* new pipe; send them again */
+	self->dyn_params_sent = 0;
+
+	ok = create_pipe(self);
+	if (!ok)
+		return ok;
+
+	return start_processing(self);
 }
 
 static GstFlowReturn send_buffer(GstDspBase *base, struct td_buffer *tb)
@@ -1238,11 +1759,15 @@ static GstFlowReturn send_buffer(GstDspBase *base, struct td_buffer *tb)
 	GstDspIpp *self = GST_DSP_IPP(base);
 	bool ok;
 	struct td_buffer *otb;
+	unsigned idx;
+	gint gen;
 
 	/* no need to send output buffer to dsp */
 	if (tb->port->id == 1) {
 		/* in stead, we will do that later on, but for now queue it as available */
 		pr_debug(self, "collecting ipp output buffer %p", tb);
+		/* after an in-place hand over; still mapped */
+		tb->pinned = true;
 		async_queue_push(self->ipp_queue, tb);
 		return true;
 	}
@@ -1265,33 +1790,80 @@ static GstFlowReturn send_buffer(GstDspBase *base, struct td_buffer *tb)
 	}
 	pr_debug(self, "got ipp output buffer %p", otb);
 
+	if (self->in_place && self->in_place_mode == IN_PLACE_AUTO &&
+			tb->user_data && !self->in_writable) {
+		if (!leave_in_place(self))
+			return GST_FLOW_ERROR;
+	}
+
 	send_processing_info_gstmessage(self, "ipp-start-init");
 
-	get_eenf_dyn_params(self);
+	/*
+	 * Only send the dynamic parameters when they changed; the control
+	 * message goes right before the queue message, without waiting for
+	 * the acknowledgement in between.
+	 */
+	gen = g_atomic_int_get(&self->dyn_params_gen);
+	if (self->eenf_idx >= 0 && self->eenf_strength != NOISE_FILTER_OFF &&
+			gen != self->dyn_params_sent) {
+		if (!get_eenf_dyn_params(self))
+			return GST_FLOW_ERROR;
 
-	ok = control_pipe(self);
-	if (!ok)
-		return GST_FLOW_ERROR;
+		ok = control_pipe(self);
+		if (!ok)
+			return GST_FLOW_ERROR;
 
-	dmm_buffer_map(tb->data);
+		self->dyn_params_sent = gen;
+	}
 
-	self->sync_sem->count = 0;
+	/*
+	 * At most as many as output buffers, so there's always a free slot;
+	 * only this thread takes them, so it stays free until then.
+	 */
+	g_mutex_lock(self->frames_mutex);
+	idx = (self->frame_pos + self->nr_frames) % IPP_MAX_FRAMES;
+	g_mutex_unlock(self->frames_mutex);
+
+	self->frames[idx].in = tb;
+	self->frames[idx].out = otb;
+	self->frames[idx].src = get_input(self, idx);
+
+	g_mutex_lock(self->frames_mutex);
+	self->frames[idx].start = get_time();
+	self->nr_frames++;
+	g_mutex_unlock(self->frames_mutex);
 
-	ok = queue_buffer(GST_DSP_IPP(base), tb, otb);
+	ok = queue_buffer(self, idx);
 	if (!ok)
 		return GST_FLOW_ERROR;
 
+	/*
+	 * Like before, the flush goes right behind the queue message, with the
+	 * frame still in flight; it's what gets the pipe going.
+	 */
 	ok = flush_queue_buffer(self);
 	if (!ok)
 		return GST_FLOW_ERROR;
 
-	/* wait until processing finished */
-	if (!g_sem_down_timed(self->sync_sem, IPP_TIMEOUT)) {
-		pr_err(self, "waiting for processing timed out");
-		return GST_FLOW_ERROR;
+	/* don't wait; the DSP can process this while we prepare the next */
+	return GST_FLOW_OK;
+}
+
+/* wait for the frames in flight */
+static bool wait_frames(GstDspIpp *self)
+{
+	g_mutex_lock(self->frames_mutex);
+	while (self->nr_frames) {
+		g_mutex_unlock(self->frames_mutex);
+		if (!g_sem_down_timed(self->sync_sem, IPP_TIMEOUT)) {
+			pr_err(self, "waiting for processing timed out");
+			return false;
+		}
+		g_mutex_lock(self->frames_mutex);
 	}
+	g_mutex_unlock(self->frames_mutex);
 
-	return GST_FLOW_OK;
+	return true;
 }
 
 static bool send_play_message(GstDspBase *base)
@@ -1303,8 +1875,16 @@ static void reset(GstDspBase *base)
 {
 	GstDspIpp *self = GST_DSP_IPP(base);
 
-	self->msg_sem->count = 1;
+	self->msg_sem->count = IPP_MAX_MSGS;
+	self->msg_pos = self->nr_msgs = 0;
+	self->sync_sem->count = 0;
+	self->frame_pos = self->nr_frames = 0;
+	self->last_done = 0;
+	self->pipe_ready = false;
+	/* new pipe; send them again */
+	self->dyn_params_sent = 0;
 
+	g_mutex_lock(self->msgs_mutex);
 	for (unsigned i = 0; i < self->nr_algos; i++) {
 		struct ipp_algo *algo = self->algos[i];
 		if (!algo)
@@ -1312,20 +1892,25 @@ static void reset(GstDspBase *base)
 		dmm_buffer_free(algo->create_params);
 		dmm_buffer_free(algo->b_algo_fxn);
 		dmm_buffer_free(algo->b_dma_fxn);
-		dmm_buffer_free(algo->in);
-		dmm_buffer_free(algo->out);
+		for (unsigned j = 0; j < IPP_MAX_FRAMES; j++) {
+			dmm_buffer_free(algo->in[j]);
+			dmm_buffer_free(algo->out[j]);
+		}
 		free(algo);
 		self->algos[i] = NULL;
 	}
+	self->nr_algos = 0;
+	g_mutex_unlock(self->msgs_mutex);
 
 	dmm_buffer_free(self->flt_graph);
 	self->flt_graph = NULL;
-	dmm_buffer_free(self->intermediate_buf);
-	self->intermediate_buf = NULL;
-	dmm_buffer_free(self->dyn_params);
-	self->dyn_params = NULL;
-	dmm_buffer_free(self->status_params);
-	self->status_params = NULL;
+	for (unsigned i = 0; i < IPP_MAX_FRAMES; i++) {
+		dmm_buffer_free(self->frames[i].intermediate);
+		self->frames[i].intermediate = NULL;
+		dmm_buffer_free(self->frames[i].bounce);
+		self->frames[i].bounce = NULL;
+	}
+	free_msg_arena(self);
 	async_queue_flush(self->ipp_queue);
 }
 
@@ -1334,7 +1919,11 @@ static bool send_stop_message(GstDspBase *base)
 	GstDspIpp *self = GST_DSP_IPP(base);
 	bool ok = true;
 
-	if (base->dsp_error)
+	if (base->dsp_error || !self->pipe_ready)
+		goto leave;
+
+	ok = wait_frames(self);
+	if (!ok)
 		goto leave;
 
 	ok = stop_processing(self);
@@ -1353,11 +1942,9 @@ static bool send_stop_message(GstDspBase *base)
 	if (!ok)
 		goto leave;
 
-	/* let's wait for the previous msg to complete */
-	if (!g_sem_down_timed(self->msg_sem, IPP_TIMEOUT)) {
-		pr_err(self, "ipp send msg timed out");
+	/* let's wait for the previous msgs to complete */
+	if (!wait_msgs(self))
 		return false;
-	}
 
 leave:
 	return ok;
@@ -1537,8 +2124,8 @@ static gboolean sink_setcaps(GstPad *pad, GstCaps *caps)
 	if (!gst_pad_take_caps(base->srcpad, out_caps))
 		return FALSE;
 
-	du_port_alloc_buffers(base->ports[0], 1);
-	du_port_alloc_buffers(base->ports[1], 2);
+	du_port_alloc_buffers(base->ports[0], IPP_MAX_FRAMES);
+	du_port_alloc_buffers(base->ports[1], IPP_MAX_FRAMES);
 
 	base->node = create_node(self);
 
@@ -1555,8 +2142,11 @@ static gboolean sink_setcaps(GstPad *pad, GstCaps *caps)
 		return FALSE;
 	}
 
+	choose_in_place(self);
+
 	if (!init_pipe(base))
 		return FALSE;
+	self->pipe_ready = true;
 
 	return true;
 }
@@ -1640,6 +2230,8 @@ static gboolean sink_event(GstDspBase *base, GstEvent *event)
 		if (gst_structure_get_uint(structure, "ratio-downsample-cb-cr", &tmp))
 			param->ratio_downsample_cb_cr = tmp;
 
+		g_atomic_int_inc(&self->dyn_params_gen);
+
 		gst_event_unref(event);
 
 		return true;
@@ -1710,8 +2302,24 @@ set_property(GObject *obj,
 	GstDspIpp *self = GST_DSP_IPP(obj);
 
 	switch (prop_id) {
-	case PROP_NOISE_FILTER_STRENGTH:
-		self->eenf_strength = g_value_get_enum(value);
+	case PROP_NOISE_FILTER_STRENGTH: {
+		gint strength = g_value_get_enum(value);
+		bool on = (self->algorithms & IPP_ALGO_EENF) && strength != NOISE_FILTER_OFF;
+
+		/* the stages are fixed once the pipe is built */
+		if (self->pipe_ready && on != (self->eenf_idx >= 0)) {
+			pr_warning(self, "noise filter can't be turned on or off while running");
+			break;
+		}
+		self->eenf_strength = strength;
+		g_atomic_int_inc(&self->dyn_params_gen);
+		break;
+	}
+	case PROP_ALGORITHMS:
+		self->algorithms = g_value_get_flags(value);
+		break;
+	case PROP_IN_PLACE:
+		self->in_place_mode = g_value_get_enum(value);
 		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
@@ -1719,6 +2327,61 @@ set_property(GObject *obj,
 	}
 }
 
+static GstStructure *
+get_stats(GstDspIpp *self)
+{
+	GstStructure *s;
+	unsigned i;
+
+	s = gst_structure_new("ipp-stats", NULL);
+
+	g_mutex_lock(self->msgs_mutex);
+	for (i = 0; i < ARRAY_SIZE(msg_names); i++) {
+		struct ipp_msg_stats *stats = &self->msg_stats[i];
+		gchar *name;
+
+		if (!stats->count)
+			continue;
+
+		name = g_strdup_printf("%s-count", msg_names[i]);
+		gst_structure_set(s, name, G_TYPE_UINT, stats->count, NULL);
+		g_free(name);
+		name = g_strdup_printf("%s-latency-avg", msg_names[i]);
+		gst_structure_set(s, name, G_TYPE_UINT64, stats->total / stats->count, NULL);
+		g_free(name);
+		name = g_strdup_printf("%s-latency-max", msg_names[i]);
+		gst_structure_set(s, name, G_TYPE_UINT64, stats->max, NULL);
+		g_free(name);
+	}
+
+	/* per stage */
+	for (i = 0; i < self->nr_algos; i++) {
+		struct ipp_algo *algo = self->algos[i];
+		gchar *name;
+
+		if (!algo)
+			continue;
+
+		name = g_strdup_printf("%s-errors", algo->name);
+		gst_structure_set(s, name, G_TYPE_UINT, algo->errors, NULL);
+		g_free(name);
+		name = g_strdup_printf("%s-control-errors", algo->name);
+		gst_structure_set(s, name, G_TYPE_UINT, algo->control_errors, NULL);
+		g_free(name);
+		name = g_strdup_printf("%s-last-error", algo->name);
+		gst_structure_set(s, name, G_TYPE_INT, algo->last_error, NULL);
+		g_free(name);
+	}
+
+	gst_structure_set(s,
+			"width", G_TYPE_INT, self->width,
+			"height", G_TYPE_INT, self->height,
+			NULL);
+	g_mutex_unlock(self->msgs_mutex);
+
+	return s;
+}
+
 static void
 get_property(GObject *obj,
 	     guint prop_id,
@@ -1731,6 +2394,15 @@ get_property(GObject *obj,
 	case PROP_NOISE_FILTER_STRENGTH:
 		g_value_set_enum(value, self->eenf_strength);
 		break;
+	case PROP_STATS:
+		g_value_take_boxed(value, get_stats(self));
+		break;
+	case PROP_ALGORITHMS:
+		g_value_set_flags(value, self->algorithms);
+		break;
+	case PROP_IN_PLACE:
+		g_value_set_enum(value, self->in_place_mode);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
 		break;
@@ -1753,8 +2425,15 @@ static void instance_init(GTypeInstance *instance, gpointer g_class)
 	base->send_play_message = send_play_message;
 	base->send_stop_message = send_stop_message;
 	base->reset = reset;
-	self->msg_sem = g_sem_new(1);
+	base->pre_process_buffer = pre_process_buffer;
+	self->msg_sem = g_sem_new(IPP_MAX_MSGS);
+	self->msgs_mutex = g_mutex_new();
 	self->sync_sem = g_sem_new(0);
+	self->frames_mutex = g_mutex_new();
+	self->dyn_params_gen = 1;
+	self->algorithms = DEFAULT_ALGORITHMS;
+	self->in_place_mode = DEFAULT_IN_PLACE;
+	self->eenf_strength = DEFAULT_NOISE_FILTER_STRENGTH;
 	self->ipp_queue = async_queue_new();
 	base->eos_timeout = 0;
 	base->use_pinned = TRUE;
@@ -1774,7 +2453,9 @@ static void finalize(GObject *obj)
 	GstDspIpp *self = GST_DSP_IPP(obj);
 
 	g_sem_free(self->msg_sem);
+	g_mutex_free(self->msgs_mutex);
 	g_sem_free(self->sync_sem);
+	g_mutex_free(self->frames_mutex);
 	async_queue_free(self->ipp_queue);
 	G_OBJECT_CLASS(parent_class)->finalize(obj);
 }
@@ -1792,11 +2473,31 @@ static void class_init(gpointer g_class, gpointer class_data)
 
 	g_object_class_install_property(gobject_class, PROP_NOISE_FILTER_STRENGTH,
 			g_param_spec_enum("noise-filter-strength", "Noise filter strength",
-				"Specifies the strength of the noise filter",
+				"Specifies the strength of the noise filter (can't be turned off or on while running)",
 				GST_TYPE_IPP_NOISE_FILTER_STRENGTH,
 				DEFAULT_NOISE_FILTER_STRENGTH,
 				G_PARAM_READWRITE));
 
+	g_object_class_install_property(gobject_class, PROP_ALGORITHMS,
+			g_param_spec_flags("algorithms", "Algorithms",
+				"Optional stages of the processing chain (applied on the next caps)",
+				GST_TYPE_IPP_ALGORITHMS,
+				DEFAULT_ALGORITHMS,
+				G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_IN_PLACE,
+			g_param_spec_enum("in-place", "In-place processing",
+				"Process in the input buffer instead of an intermediate one",
+				GST_TYPE_IPP_IN_PLACE,
+				DEFAULT_IN_PLACE,
+				G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_STATS,
+			g_param_spec_boxed("stats", "Statistics",
+				"Message latencies in microseconds",
+				GST_TYPE_STRUCTURE,
+				G_PARAM_READABLE));
+
 	parent_class = g_type_class_peek_parent(g_class);
 	gobject_class->finalize = finalize;
 	gstdspbase_class->sink_event = sink_event;
@@ -25,20 +25,51 @@ G_BEGIN_DECLS
   (G_TYPE_CHECK_INSTANCE_TYPE((obj), gst_dsp_ipp_get_type()))
 
 #define IPP_MAX_NUM_OF_ALGOS 5
+#define IPP_MAX_FRAMES 2
+#define IPP_MAX_MSGS 4
 
 typedef struct _GstDspIpp GstDspIpp;
 typedef struct _GstDspIppClass GstDspIppClass;
 
 struct ipp_algo {
+	const char *name;
 	dmm_buffer_t *create_params;
 	const char *fxn;
 	const char *dma_fxn;
-	dmm_buffer_t *in;
-	dmm_buffer_t *out;
+	/* in and out args, one of each per frame in flight */
+	dmm_buffer_t *in[IPP_MAX_FRAMES];
+	dmm_buffer_t *out[IPP_MAX_FRAMES];
 
 	/* TODO no need to keep these around */
 	dmm_buffer_t *b_algo_fxn;
 	dmm_buffer_t *b_dma_fxn;
+
+	/* stats */
+	guint errors;
+	guint control_errors;
+	int32_t last_error;
+};
+
+struct ipp_frame {
+	struct td_buffer *in;
+	struct td_buffer *out;
+	guint64 start;
+	dmm_buffer_t *src; /* what the DSP reads: the input, or the bounce */
+	/* kept for the next frame in this slot */
+	dmm_buffer_t *intermediate;
+	dmm_buffer_t *bounce;
+};
+
+struct ipp_msg {
+	int id;
+	dmm_buffer_t *args[3];
+	guint64 start;
+};
+
+struct ipp_msg_stats {
+	guint count;
+	guint64 total; /* us */
+	guint64 max;
 };
 
 struct ipp_eenf_params {
@@ -72,19 +103,29 @@ struct _GstDspIpp {
 	int in_pix_fmt;
 	struct ipp_algo *algos[IPP_MAX_NUM_OF_ALGOS];
 	unsigned nr_algos;
+	unsigned algorithms;
+	int eenf_idx;
+	int in_place_mode;
+	bool in_place, in_writable;
+	bool pipe_ready;
 	GSem *msg_sem;
 	struct ipp_eenf_params eenf_params;
 	int eenf_strength;
+	gint dyn_params_gen, dyn_params_sent;
 	GSem *sync_sem;
 	AsyncQueue *ipp_queue;
 
-	dmm_buffer_t *msg_ptr[3];
+	struct ipp_msg msgs[IPP_MAX_MSGS];
+	unsigned msg_pos, nr_msgs;
+	GMutex *msgs_mutex;
+	struct ipp_msg_stats msg_stats[16]; /* per DFGM command */
 	dmm_buffer_t *flt_graph;
-	struct td_buffer *in_buf_ptr;
-	struct td_buffer *out_buf_ptr;
-	dmm_buffer_t *intermediate_buf;
-	dmm_buffer_t *dyn_params;
-	dmm_buffer_t *status_params;
+	struct ipp_frame frames[IPP_MAX_FRAMES];
+	unsigned frame_pos, nr_frames;
+	GMutex *frames_mutex;
+	guint64 last_done; /* when the DSP finished the previous frame */
+	dmm_buffer_t *msg_arena;
+	dmm_buffer_t *msg_elems;
 };
 
 struct _GstDspIppClass {
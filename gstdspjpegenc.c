@@ -16,13 +16,22 @@
 
 #include "log.h"
 
+#include <string.h> /* for memcpy */
+
 #define GST_CAT_DEFAULT gstdsp_debug
 
+static GstDspBaseClass *parent_class;
+
 #define DEFAULT_ENCODING_QUALITY 90
+#define DEFAULT_BURST 1
+#define MAX_BURST 4
+#define DEFAULT_STRIP_HEIGHT 0
 
 enum {
 	ARG_0,
 	ARG_QUALITY,
+	ARG_BURST,
+	ARG_STRIP_HEIGHT,
 };
 
 static void
@@ -32,6 +41,7 @@ set_property(GObject *obj,
 	     GParamSpec *pspec)
 {
 	GstDspVEnc *self = GST_DSP_VENC(obj);
+	GstDspJpegEnc *jpegenc = GST_DSP_JPEGENC(obj);
 
 	switch (prop_id) {
 	case ARG_QUALITY: {
@@ -45,6 +55,18 @@ set_property(GObject *obj,
 		}
 		break;
 	}
+	case ARG_BURST:
+		/* the buffers are allocated with the node */
+		if (GST_STATE(self) == GST_STATE_NULL)
+			self->burst = g_value_get_uint(value);
+		else
+			GST_WARNING_OBJECT(self,
+					"burst property can be set only in NULL state");
+		break;
+	case ARG_STRIP_HEIGHT:
+		/* takes effect with the next caps */
+		jpegenc->strip_height = g_value_get_uint(value);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
 		break;
@@ -58,11 +80,18 @@ get_property(GObject *obj,
 	     GParamSpec *pspec)
 {
 	GstDspVEnc *self = GST_DSP_VENC(obj);
+	GstDspJpegEnc *jpegenc = GST_DSP_JPEGENC(obj);
 
 	switch (prop_id) {
 	case ARG_QUALITY:
 		g_value_set_uint(value, g_atomic_int_get(&self->quality));
 		break;
+	case ARG_BURST:
+		g_value_set_uint(value, self->burst);
+		break;
+	case ARG_STRIP_HEIGHT:
+		g_value_set_uint(value, jpegenc->strip_height);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
 		break;
@@ -85,12 +114,445 @@ generate_src_template(void)
 	return caps;
 }
 
+/*
+ * Images taller than the node is set up for are encoded in horizontal
+ * strips, each one a JPEG of its own with a restart marker after every row
+ * of MCUs. A restart resets the DC predictors, so the scans of all the
+ * strips can be joined with restart markers in between, under the headers
+ * of the first one, into a single valid image.
+ */
+
+struct jpeg_layout {
+	guint sof, sos, scan, end;
+	guint mcu_width, mcu_height;
+	gboolean dri;
+};
+
+static guint
+get_strip_height(GstDspJpegEnc *self,
+		 gint height)
+{
+	guint max = self->strip_height;
+	guint count;
+
+	if (!max) {
+		if (height <= JPEGENC_MAX_HEIGHT)
+			return 0;
+		max = JPEGENC_MAX_HEIGHT;
+	}
+
+	/* MCU aligned */
+	max = MAX(max & ~15, 16);
+	if (height <= (gint) max)
+		return 0;
+
+	/* as even as possible */
+	count = (height + max - 1) / max;
+	return ROUND_UP((height + count - 1) / count, 16);
+}
+
+static gboolean
+parse_jpeg(const guint8 *data,
+	    guint size,
+	    struct jpeg_layout *l)
+{
+	guint pos = 2;
+
+	memset(l, 0, sizeof(*l));
+
+	if (size < 4 || data[0] != 0xff || data[1] != 0xd8)
+		return FALSE;
+
+	while (pos + 4 <= size) {
+		guint8 marker;
+		guint len, i, n;
+
+		if (data[pos] != 0xff)
+			return FALSE;
+
+		marker = data[pos + 1];
+		if (marker == 0xff) {
+			/* fill byte */
+			pos++;
+			continue;
+		}
+
+		len = GST_READ_UINT16_BE(data + pos + 2);
+		if (pos + 2 + len > size)
+			return FALSE;
+
+		switch (marker) {
+		case 0xc0: /* baseline */
+		case 0xc1:
+			if (len < 8)
+				return FALSE;
+			n = data[pos + 9];
+			if (len < 8 + 3 * n)
+				return FALSE;
+			l->sof = pos;
+			for (i = 0; i < n; i++) {
+				guint8 sampling = data[pos + 11 + i * 3];
+				l->mcu_width = MAX(l->mcu_width, (sampling >> 4) * 8);
+				l->mcu_height = MAX(l->mcu_height, (sampling & 0xf) * 8);
+			}
+			break;
+		case 0xdd:
+			l->dri = TRUE;
+			break;
+		case 0xda:
+			if (!l->sof || !l->mcu_width || !l->mcu_height)
+				return FALSE;
+			l->sos = pos;
+			l->scan = pos + 2 + len;
+			l->end = size;
+			if (size >= l->scan + 2 && data[size - 2] == 0xff && data[size - 1] == 0xd9)
+				l->end = size - 2;
+			return TRUE;
+		default:
+			break;
+		}
+
+		pos += 2 + len;
+	}
+
+	return FALSE;
+}
+
+/*
+ * Renumbers the restart markers of a strip to follow the ones before it,
+ * and returns how much of the scan covers the first 'rows' rows of MCUs.
+ */
+static guint
+fix_restarts(GstDspJpegEnc *self,
+	     guint8 *data,
+	     guint size,
+	     guint rows)
+{
+	guint8 *p = data, *end = data + size;
+
+	while ((p = memchr(p, 0xff, end - p)) && p + 1 < end) {
+		guint8 marker = p[1];
+
+		if (marker >= 0xd0 && marker <= 0xd7) {
+			if (--rows == 0)
+				return p - data;
+			p[1] = 0xd0 | (self->strips.restarts++ & 7);
+			p += 2;
+		} else if (marker == 0x00) {
+			/* stuffing */
+			p += 2;
+		} else
+			p++;
+	}
+
+	return size;
+}
+
+static inline void
+copy_lines(guint8 *dst,
+	   const guint8 *src,
+	   guint stride,
+	   guint lines,
+	   guint total)
+{
+	guint i;
+
+	memcpy(dst, src, stride * lines);
+
+	/* repeat the last one to fill the MCUs */
+	for (i = lines; i < total; i++)
+		memcpy(dst + i * stride, src + (lines - 1) * stride, stride);
+}
+
+static GstBuffer *
+get_strip(GstDspJpegEnc *self,
+	  GstBuffer *buf,
+	  guint index)
+{
+	guint width = self->strips.width;
+	guint height = self->strips.height;
+	guint y = index * height;
+	guint lines = MIN(height, self->strips.full_height - y);
+	const guint8 *src = GST_BUFFER_DATA(buf);
+	GstBuffer *strip;
+
+	/* the default strides of GStreamer, like setup_input() expects */
+	if (self->strips.format == GST_MAKE_FOURCC('I', '4', '2', '0')) {
+		guint stride = ROUND_UP(width, 4);
+		guint chroma_stride = ROUND_UP(width / 2, 4);
+		guint full_height = self->strips.full_height;
+		guint8 *dst;
+
+		strip = gst_buffer_new_and_alloc(stride * height + chroma_stride * height);
+		dst = GST_BUFFER_DATA(strip);
+
+		copy_lines(dst, src + y * stride, stride, lines, height);
+		dst += stride * height;
+		src += stride * full_height;
+		copy_lines(dst, src + y / 2 * chroma_stride, chroma_stride,
+			   (lines + 1) / 2, height / 2);
+		dst += chroma_stride * height / 2;
+		src += chroma_stride * full_height / 2;
+		copy_lines(dst, src + y / 2 * chroma_stride, chroma_stride,
+			   (lines + 1) / 2, height / 2);
+	} else {
+		guint stride = ROUND_UP(width * 2, 4);
+
+		if (lines == height)
+			strip = gst_buffer_create_sub(buf, y * stride, height * stride);
+		else {
+			strip = gst_buffer_new_and_alloc(height * stride);
+			copy_lines(GST_BUFFER_DATA(strip), src + y * stride, stride, lines, height);
+		}
+	}
+
+	gst_buffer_copy_metadata(strip, buf, GST_BUFFER_COPY_TIMESTAMPS);
+
+	return strip;
+}
+
+static gboolean
+sink_setcaps(GstPad *pad,
+	     GstCaps *caps)
+{
+	GstDspJpegEnc *self;
+	GstDspBase *base;
+	GstStructure *struc;
+	GstCaps *strip_caps, *src_caps;
+	gint width = 0, height = 0;
+	guint strip_height;
+	gboolean ret;
+
+	self = GST_DSP_JPEGENC(GST_PAD_PARENT(pad));
+	base = GST_DSP_BASE(self);
+
+	struc = gst_caps_get_structure(caps, 0);
+	gst_structure_get_int(struc, "width", &width);
+	gst_structure_get_int(struc, "height", &height);
+
+	strip_height = get_strip_height(self, height);
+	if (!strip_height) {
+		self->strips.count = 0;
+		return self->venc_setcaps(pad, caps);
+	}
+
+	if (height % 2)
+		return FALSE;
+
+	self->strips.count = (height + strip_height - 1) / strip_height;
+	self->strips.height = strip_height;
+	self->strips.full_height = height;
+	self->strips.width = width;
+	self->strips.format = 0;
+	gst_structure_get_fourcc(struc, "format", &self->strips.format);
+
+	if ((self->strips.format != GST_MAKE_FOURCC('I', '4', '2', '0') &&
+			self->strips.format != GST_MAKE_FOURCC('U', 'Y', 'V', 'Y')) ||
+			gst_structure_has_field(struc, "rowstride"))
+	{
+		pr_err(self, "strips need packed I420 or UYVY");
+		self->strips.count = 0;
+		return FALSE;
+	}
+
+	pr_info(self, "%u strips of %u lines", self->strips.count, strip_height);
+
+	strip_caps = gst_caps_copy(caps);
+	gst_caps_set_simple(strip_caps, "height", G_TYPE_INT, strip_height, NULL);
+	ret = self->venc_setcaps(pad, strip_caps);
+	gst_caps_unref(strip_caps);
+	if (!ret)
+		return FALSE;
+
+	/* what comes out is the whole image */
+	src_caps = gst_caps_copy(GST_PAD_CAPS(base->srcpad));
+	gst_caps_set_simple(src_caps, "height", G_TYPE_INT, height, NULL);
+
+	return gst_pad_take_caps(base->srcpad, src_caps);
+}
+
+static GstFlowReturn
+pad_chain(GstPad *pad,
+	  GstBuffer *buf)
+{
+	GstDspJpegEnc *self;
+	GstDspBase *base;
+	GstFlowReturn ret = GST_FLOW_OK;
+	guint i, size, timeout;
+
+	self = GST_DSP_JPEGENC(GST_OBJECT_PARENT(pad));
+	base = GST_DSP_BASE(self);
+
+	if (!self->strips.count || GST_BUFFER_SIZE(buf) == 0)
+		return self->base_chain(pad, buf);
+
+	size = self->strips.width * self->strips.full_height;
+	if (self->strips.format == GST_MAKE_FOURCC('I', '4', '2', '0'))
+		size = size * 3 / 2;
+	else
+		size *= 2;
+
+	if (GST_BUFFER_SIZE(buf) < size) {
+		gstdsp_post_error(base, "image too small to split in strips");
+		gst_buffer_unref(buf);
+		return GST_FLOW_ERROR;
+	}
+
+	timeout = base->input_timeout;
+	self->strips.dropped = FALSE;
+
+	for (i = 0; i < self->strips.count; i++) {
+		ret = self->base_chain(pad, get_strip(self, buf, i));
+		if (ret != GST_FLOW_OK || self->strips.dropped)
+			break;
+		/* only whole images can be dropped */
+		base->input_timeout = 0;
+	}
+
+	base->input_timeout = timeout;
+	gst_buffer_unref(buf);
+
+	return ret;
+}
+
+static void
+drop_buffer(GstDspBase *base,
+	    GstBuffer *buf)
+{
+	GstDspJpegEnc *self = GST_DSP_JPEGENC(base);
+
+	self->strips.dropped = TRUE;
+	self->venc_drop_buffer(base, buf);
+}
+
+static GstFlowReturn
+push_buffer(GstDspBase *base,
+	    GstBuffer *buf)
+{
+	GstDspJpegEnc *self = GST_DSP_JPEGENC(base);
+	guint8 *data = GST_BUFFER_DATA(buf);
+	struct jpeg_layout l;
+	GByteArray *image;
+	GstBuffer *out;
+	guint index, len, rows = G_MAXUINT;
+	gboolean last;
+
+	if (!self->strips.count)
+		return self->venc_push_buffer(base, buf);
+
+	index = self->strips.index++;
+	last = self->strips.index == self->strips.count;
+
+	if (index == 0) {
+		self->strips.image = g_byte_array_sized_new(GST_BUFFER_SIZE(buf) * self->strips.count);
+		self->strips.restarts = 0;
+		self->strips.broken = FALSE;
+	}
+	image = self->strips.image;
+
+	if (self->strips.broken)
+		goto next;
+
+	if (!parse_jpeg(data, GST_BUFFER_SIZE(buf), &l)) {
+		pr_warning(self, "bad strip %u", index);
+		self->strips.broken = TRUE;
+		goto next;
+	}
+
+	/* without restart markers the scans can't be joined */
+	if (!l.dri) {
+		pr_warning(self, "no restart interval in strip %u", index);
+		self->strips.broken = TRUE;
+		goto next;
+	}
+
+	if (index == 0) {
+		g_byte_array_append(image, data, l.sos);
+		GST_WRITE_UINT16_BE(image->data + l.sof + 5, self->strips.full_height);
+		g_byte_array_append(image, data + l.sos, l.scan - l.sos);
+	} else {
+		guint8 rst[2] = { 0xff, 0xd0 | (self->strips.restarts++ & 7) };
+		g_byte_array_append(image, rst, sizeof(rst));
+	}
+
+	/* the last one was padded to a full strip */
+	if (last) {
+		guint lines = self->strips.full_height - index * self->strips.height;
+		rows = (lines + l.mcu_height - 1) / l.mcu_height;
+	}
+
+	len = fix_restarts(self, data + l.scan, l.end - l.scan, rows);
+	g_byte_array_append(image, data + l.scan, len);
+
+next:
+	if (!last) {
+		gst_buffer_unref(buf);
+		return GST_FLOW_OK;
+	}
+
+	self->strips.index = 0;
+	self->strips.image = NULL;
+
+	if (self->strips.broken) {
+		pr_warning(self, "dropping image");
+		g_byte_array_free(image, TRUE);
+		gst_buffer_unref(buf);
+		return GST_FLOW_OK;
+	}
+
+	{
+		static const guint8 eoi[] = { 0xff, 0xd9 };
+		g_byte_array_append(image, eoi, sizeof(eoi));
+	}
+
+	out = gst_buffer_new();
+	GST_BUFFER_SIZE(out) = image->len;
+	GST_BUFFER_DATA(out) = GST_BUFFER_MALLOCDATA(out) = g_byte_array_free(image, FALSE);
+	gst_buffer_copy_metadata(out, buf, GST_BUFFER_COPY_ALL);
+	gst_buffer_unref(buf);
+
+	return self->venc_push_buffer(base, out);
+}
+
+static void
+strips_clear(GstDspJpegEnc *self)
+{
+	self->strips.index = 0;
+	if (self->strips.image) {
+		g_byte_array_free(self->strips.image, TRUE);
+		self->strips.image = NULL;
+	}
+}
+
+static void
+reset(GstDspBase *base)
+{
+	GstDspJpegEnc *self = GST_DSP_JPEGENC(base);
+
+	self->venc_reset(base);
+	strips_clear(self);
+}
+
+static gboolean
+sink_event(GstDspBase *base,
+	   GstEvent *event)
+{
+	GstDspJpegEnc *self = GST_DSP_JPEGENC(base);
+
+	/* the output task is paused; the next strip starts a new image */
+	if (GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_STOP)
+		strips_clear(self);
+
+	return parent_class->sink_event(base, event);
+}
+
 static void
 instance_init(GTypeInstance *instance,
 	      gpointer g_class)
 {
 	GstDspBase *base = GST_DSP_BASE(instance);
 	GstDspVEnc *self = GST_DSP_VENC(instance);
+	GstDspJpegEnc *jpegenc = GST_DSP_JPEGENC(instance);
 
 	base->alg = GSTDSP_JPEGENC;
 	base->codec = &td_jpegenc_codec;
@@ -98,6 +560,18 @@ instance_init(GTypeInstance *instance,
 	base->use_pinned = true;
 
 	self->quality = DEFAULT_ENCODING_QUALITY;
+	self->burst = DEFAULT_BURST;
+
+	jpegenc->venc_setcaps = GST_PAD_SETCAPSFUNC(base->sinkpad);
+	gst_pad_set_setcaps_function(base->sinkpad, sink_setcaps);
+	jpegenc->base_chain = GST_PAD_CHAINFUNC(base->sinkpad);
+	gst_pad_set_chain_function(base->sinkpad, pad_chain);
+	jpegenc->venc_push_buffer = base->push_buffer;
+	base->push_buffer = push_buffer;
+	jpegenc->venc_drop_buffer = base->drop_buffer;
+	base->drop_buffer = drop_buffer;
+	jpegenc->venc_reset = base->reset;
+	base->reset = reset;
 }
 
 static void
@@ -127,7 +601,7 @@ base_init(gpointer g_class)
 	caps = gst_pad_template_get_caps(template);
 	gst_caps_set_simple(caps,
 			    "width", GST_TYPE_INT_RANGE, 16, JPEGENC_MAX_WIDTH,
-			    "height", GST_TYPE_INT_RANGE, 16, JPEGENC_MAX_HEIGHT,
+			    "height", GST_TYPE_INT_RANGE, 16, JPEGENC_MAX_STRIPS_HEIGHT,
 			    NULL);
 }
 
@@ -136,15 +610,33 @@ class_init(gpointer g_class,
 	   gpointer class_data)
 {
 	GObjectClass *gobject_class;
+	GstDspBaseClass *base_class;
+
+	parent_class = g_type_class_peek_parent(g_class);
 	gobject_class = (GObjectClass *) g_class;
+	base_class = GST_DSP_BASE_CLASS(g_class);
 
 	gobject_class->set_property = set_property;
 	gobject_class->get_property = get_property;
+	base_class->sink_event = sink_event;
 
 	g_object_class_install_property(gobject_class, ARG_QUALITY,
 					g_param_spec_uint("encoding-quality", "Encoding quality",
 							 "Encoding quality level", 1, 100, DEFAULT_ENCODING_QUALITY,
 							 G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, ARG_BURST,
+					g_param_spec_uint("burst", "Burst",
+							  "Number of images queued to the DSP at once",
+							  1, MAX_BURST, DEFAULT_BURST,
+							  G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, ARG_STRIP_HEIGHT,
+					g_param_spec_uint("strip-height", "Strip height",
+							  "Encode in strips of at most this many lines "
+							  "(0 = only images taller than the DSP limit)",
+							  0, JPEGENC_MAX_HEIGHT, DEFAULT_STRIP_HEIGHT,
+							  G_PARAM_READWRITE));
 }
 
 GType
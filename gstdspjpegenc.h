@@ -27,8 +27,33 @@ typedef struct _GstDspJpegEncClass GstDspJpegEncClass;
 #define JPEGENC_MAX_WIDTH 4096
 #define JPEGENC_MAX_HEIGHT 4096
 
+/* sink height reachable by encoding in strips; the most a SOF can say */
+#define JPEGENC_MAX_STRIPS_HEIGHT 65535
+
 struct _GstDspJpegEnc {
 	GstDspVEnc element;
+	guint strip_height; /* 0 for automatic */
+
+	/* strip mode; tall images go through the node in horizontal strips */
+	struct {
+		guint count; /* per image; 0 when not in use */
+		gint height, full_height;
+		gint width;
+		guint32 format;
+		gboolean dropped;
+
+		/* output */
+		guint index;
+		guint restarts;
+		GByteArray *image; /* being stitched */
+		gboolean broken;
+	} strips;
+
+	GstPadSetCapsFunction venc_setcaps;
+	GstPadChainFunction base_chain;
+	GstFlowReturn (*venc_push_buffer)(GstDspBase *base, GstBuffer *buf);
+	void (*venc_drop_buffer)(GstDspBase *base, GstBuffer *buf);
+	void (*venc_reset)(GstDspBase *base);
 };
 
 struct _GstDspJpegEncClass {
@@ -214,12 +214,12 @@ bail:
 
 static inline bool mpeg4_next_start_code(struct get_bit_context *s)
 {
-	if (get_bits_left(s) < 8 - (int) s->index % 8)
+	if (get_bits_left(s) < 8 - (int) get_bits_count(s) % 8)
 		goto failed;
 	if (get_bits1(s))
 		goto failed;
 
-	while (s->index % 8 != 0) {
+	while (get_bits_count(s) % 8 != 0) {
 		if (!get_bits1(s))
 			goto failed;
 	}
@@ -467,33 +467,6 @@ static unsigned read_bits(struct get_bit_context *s, int n)
 	return get_bits(s, n);
 }
 
-/* read unsigned Exp-Golomb code */
-static unsigned get_ue_golomb(struct get_bit_context *s)
-{
-	unsigned i;
-
-	for (i = 0; i < 32; i++) {
-		if (read_bits(s, 1) != 0)
-			break;
-		if (get_bits_left(s) <= 0)
-			break;
-	}
-
-	return (1 << i) - 1 + read_bits(s, i);
-}
-
-/* read signed Exp-Golomb code */
-static int get_se_golomb(struct get_bit_context *s)
-{
-	int i = 0;
-
-	i = get_ue_golomb(s);
-	/* (-1)^(i+1) Ceil (i / 2) */
-	i = (i + 1) / 2 * (i & 1 ? 1 : -1);
-
-	return i;
-}
-
 #define CHECK_EOS(s) \
 	do { \
 		if (get_bits_left(s) <= 0) \
@@ -601,7 +574,7 @@ try_again:
 		}
 		tsize = get_bits(&s, 16);
 	} else {
-		s.index = 0;
+		init_get_bits(&s, buf->data, buf->size * 8);
 
 		/* frame size is recorded in Sequence Parameter Set (SPS) */
 		/* locate SPS NAL unit in bytestream */
@@ -814,3 +787,161 @@ bail:
 	free(rbsp_buffer);
 	return false;
 }
+
+/*
+ * Only baseline, extended sequential and progressive Huffman-coded images
+ * with 8-bit samples are handled by the DSP. Anything else is rejected here,
+ * by leaving output_buffer_size at zero, so it never reaches the node.
+ */
+bool gst_dsp_jpeg_parse(GstDspBase *base, GstBuffer *buf)
+{
+	GstDspVDec *vdec = GST_DSP_VDEC(base);
+	const uint8_t *p = buf->data;
+	const uint8_t *end = buf->data + buf->size;
+	unsigned width = 0, height = 0;
+	unsigned components = 0;
+	unsigned h_samp[3], v_samp[3];
+	unsigned h_max = 1, v_max = 1;
+	unsigned restart_interval = 0;
+	bool progressive = false;
+	bool got_sof = false;
+	unsigned i;
+
+	if (end - p < 4 || p[0] != 0xff || p[1] != 0xd8)
+		goto bail;
+	p += 2;
+
+	while (true) {
+		unsigned marker, len;
+
+		if (end - p < 2)
+			goto not_enough;
+		if (*p++ != 0xff)
+			goto bail;
+		/* fill bytes */
+		while (p < end && *p == 0xff)
+			p++;
+		if (p >= end)
+			goto not_enough;
+		marker = *p++;
+
+		/* standalone markers */
+		if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7))
+			continue;
+		if (marker == 0xd8 || marker == 0xd9)
+			goto bail;
+
+		if (end - p < 2)
+			goto not_enough;
+		len = p[0] << 8 | p[1];
+		if (len < 2)
+			goto bail;
+		if ((unsigned) (end - p) < len)
+			goto not_enough;
+
+		switch (marker) {
+		case 0xc0: /* baseline */
+		case 0xc1: /* extended sequential */
+		case 0xc2: /* progressive */
+			if (got_sof || len < 8)
+				goto bail;
+			if (p[2] != 8) {
+				pr_err(base, "unsupported sample precision %u", p[2]);
+				goto unsupported;
+			}
+			height = p[3] << 8 | p[4];
+			width = p[5] << 8 | p[6];
+			components = p[7];
+			if (!width || !height) {
+				/* height in DNL */
+				pr_err(base, "unsupported dimensions %ux%u", width, height);
+				goto unsupported;
+			}
+			if (components != 1 && components != 3) {
+				pr_err(base, "unsupported number of components %u", components);
+				goto unsupported;
+			}
+			if (len < 8 + components * 3)
+				goto bail;
+			for (i = 0; i < components; i++) {
+				h_samp[i] = p[9 + i * 3] >> 4;
+				v_samp[i] = p[9 + i * 3] & 0xf;
+				if (!h_samp[i] || !v_samp[i])
+					goto bail;
+				h_max = MAX(h_max, h_samp[i]);
+				v_max = MAX(v_max, v_samp[i]);
+			}
+			progressive = marker == 0xc2;
+			got_sof = true;
+			break;
+		case 0xc3:
+		case 0xc5: case 0xc6: case 0xc7:
+		case 0xc9: case 0xca: case 0xcb:
+		case 0xcd: case 0xce: case 0xcf:
+			pr_err(base, "unsupported coding process SOF%u", marker - 0xc0);
+			goto unsupported;
+		case 0xdd: /* DRI */
+			if (len < 4)
+				goto bail;
+			restart_interval = p[2] << 8 | p[3];
+			break;
+		case 0xda: /* SOS */
+			if (!got_sof)
+				goto bail;
+			goto done;
+		default:
+			break;
+		}
+
+		p += len;
+	}
+
+done:
+	if (components == 1) {
+		/* non-interleaved, MCUs are always one block */
+		h_max = v_max = 1;
+	} else {
+		/* chroma must not be sampled more than luma */
+		if (h_samp[1] != 1 || v_samp[1] != 1 ||
+				h_samp[2] != 1 || v_samp[2] != 1 ||
+				h_samp[0] > 2 || v_samp[0] > 2)
+		{
+			pr_err(base, "unsupported sampling %ux%u,%ux%u,%ux%u",
+					h_samp[0], v_samp[0],
+					h_samp[1], v_samp[1],
+					h_samp[2], v_samp[2]);
+			goto unsupported;
+		}
+	}
+
+	pr_debug(base, "width=%u, height=%u, components=%u, progressive=%u, dri=%u",
+			width, height, components, progressive, restart_interval);
+
+	vdec->jpeg_is_interlaced = progressive;
+
+	/* I420 output is only possible for 4:2:0 images */
+	if (vdec->color_format == GST_MAKE_FOURCC('I', '4', '2', '0') &&
+			(components != 3 || h_samp[0] != 2 || v_samp[0] != 2))
+	{
+		vdec->color_format = GST_MAKE_FOURCC('U', 'Y', 'V', 'Y');
+		if (base->tmp_caps)
+			gst_caps_set_simple(base->tmp_caps,
+					"format", GST_TYPE_FOURCC, vdec->color_format,
+					NULL);
+	}
+
+	/* the decoder writes whole MCUs */
+	set_framesize(base,
+			ROUND_UP(width, 8 * h_max), ROUND_UP(height, 8 * v_max),
+			0, 0, width, height);
+	return true;
+
+unsupported:
+	base->output_buffer_size = 0;
+	return false;
+
+not_enough:
+	pr_err(base, "not enough data");
+bail:
+	return false;
+}
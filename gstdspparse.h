@@ -19,5 +19,6 @@
 bool gst_dsp_h263_parse(GstDspBase *base, GstBuffer *buf);
 bool gst_dsp_mpeg4_parse(GstDspBase *base, GstBuffer *buf);
 bool gst_dsp_h264_parse(GstDspBase *base, GstBuffer *buf);
+bool gst_dsp_jpeg_parse(GstDspBase *base, GstBuffer *buf);
 
 #endif
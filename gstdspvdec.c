@@ -540,6 +540,7 @@ sink_setcaps(GstPad *pad,
 		base->alg = GSTDSP_JPEGDEC;
 		gst_structure_get_boolean(in_struc, "interlaced",
 					  &self->jpeg_is_interlaced);
+		base->parse_func = gst_dsp_jpeg_parse;
 	}
 	else if (strcmp(name, "video/x-divx") == 0) {
 		base->alg = GSTDSP_MPEG4VDEC;
@@ -11,12 +11,15 @@
  */
 
 #include "gstdspvenc.h"
+#include "gstdspbuffer.h"
 #include "plugin.h"
 
 #include "util.h"
 #include "dsp_bridge.h"
+#include "yuv.h"
 
 #include <string.h> /* for memcpy */
+#include <time.h>
 
 #include "log.h"
 
@@ -31,6 +34,13 @@ enum {
 	ARG_KEYFRAME_INTERVAL,
 	ARG_MAX_BITRATE,
 	ARG_INTRA_REFRESH,
+	ARG_ADAPTIVE_BITRATE,
+	ARG_MIN_BITRATE,
+	ARG_ADAPTIVE_KEYFRAMES,
+	ARG_ADAPTIVE_PUSH_TIME,
+	ARG_FRAME_MESSAGES,
+	ARG_STATS,
+	ARG_INPUT_TIMEOUT,
 };
 
 #define DEFAULT_BITRATE 0
@@ -38,6 +48,12 @@ enum {
 #define DEFAULT_MODE 0
 #define DEFAULT_KEYFRAME_INTERVAL 1
 #define DEFAULT_INTRA_REFRESH (DEFAULT_MODE == 1)
+#define DEFAULT_ADAPTIVE_BITRATE FALSE
+#define DEFAULT_MIN_BITRATE 0
+#define DEFAULT_ADAPTIVE_KEYFRAMES FALSE
+#define DEFAULT_ADAPTIVE_PUSH_TIME FALSE
+#define DEFAULT_FRAME_MESSAGES FALSE
+#define DEFAULT_INPUT_TIMEOUT 0
 
 #define GST_TYPE_DSPVENC_MODE gst_dspvenc_mode_get_type()
 static GType
@@ -78,6 +94,19 @@ generate_sink_template(void)
 
 	gst_caps_append_structure(caps, struc);
 
+	/* converted on the way in */
+	struc = gst_structure_new("video/x-raw-yuv",
+				  "format", GST_TYPE_FOURCC, GST_MAKE_FOURCC('N', 'V', '1', '2'),
+				  NULL);
+
+	gst_caps_append_structure(caps, struc);
+
+	struc = gst_structure_new("video/x-raw-yuv",
+				  "format", GST_TYPE_FOURCC, GST_MAKE_FOURCC('Y', 'U', 'Y', '2'),
+				  NULL);
+
+	gst_caps_append_structure(caps, struc);
+
 	return caps;
 }
 
@@ -244,6 +273,120 @@ search:
 	pr_info(self, "level: %d", self->level);
 }
 
+static bool
+convert_buffer(GstDspBase *base,
+	       GstBuffer *buf,
+	       struct td_buffer *tb)
+{
+	GstDspVEnc *self = GST_DSP_VENC(base);
+	const guint8 *src = GST_BUFFER_DATA(buf);
+	guint8 *dst = tb->data->data;
+	guint width = self->width, height = self->height;
+	guint *stride = self->input.stride;
+	gsize chroma = stride[0] * ROUND_UP(height, 2);
+
+	if (G_UNLIKELY(GST_BUFFER_SIZE(buf) < self->input.size)) {
+		pr_warning(self, "buffer too small: %u, dropping", GST_BUFFER_SIZE(buf));
+		return false;
+	}
+
+	switch (self->input.format) {
+	case GST_MAKE_FOURCC('I', '4', '2', '0'):
+		yuv_copy_plane(dst, width, src, stride[0], width, height);
+		dst += width * height;
+		src += chroma;
+		yuv_copy_plane(dst, width / 2, src, stride[1], width / 2, height / 2);
+		dst += width * height / 4;
+		src += stride[1] * ROUND_UP(height, 2) / 2;
+		yuv_copy_plane(dst, width / 2, src, stride[1], width / 2, height / 2);
+		break;
+	case GST_MAKE_FOURCC('N', 'V', '1', '2'):
+		yuv_copy_plane(dst, width, src, stride[0], width, height);
+		dst += width * height;
+		yuv_split_uv(dst, dst + width * height / 4, width / 2,
+				src + chroma, stride[1], width / 2, height / 2);
+		break;
+	case GST_MAKE_FOURCC('U', 'Y', 'V', 'Y'):
+		yuv_copy_plane(dst, width * 2, src, stride[0], width * 2, height);
+		break;
+	case GST_MAKE_FOURCC('Y', 'U', 'Y', '2'):
+		yuv_swap_bytes(dst, width * 2, src, stride[0], width * 2, height);
+		break;
+	default:
+		break;
+	}
+
+	return true;
+}
+
+/*
+ * The DSP takes tightly packed I420 or UYVY; anything else is repacked
+ * straight into the input buffer.
+ */
+static void
+setup_input(GstDspVEnc *self,
+	    GstStructure *struc,
+	    gint width,
+	    gint height)
+{
+	GstDspBase *base = GST_DSP_BASE(self);
+	guint32 format = 0;
+	gint rowstride = 0;
+	gboolean planar;
+	gsize size;
+
+	gst_structure_get_fourcc(struc, "format", &format);
+	gst_structure_get_int(struc, "rowstride", &rowstride);
+
+	planar = format == GST_MAKE_FOURCC('I', '4', '2', '0') ||
+		format == GST_MAKE_FOURCC('N', 'V', '1', '2');
+
+	if (format == GST_MAKE_FOURCC('N', 'V', '1', '2'))
+		self->color_format = GST_MAKE_FOURCC('I', '4', '2', '0');
+	else if (format == GST_MAKE_FOURCC('Y', 'U', 'Y', '2'))
+		self->color_format = GST_MAKE_FOURCC('U', 'Y', 'V', 'Y');
+	else
+		self->color_format = format;
+
+	self->input.format = format;
+
+	/* the default strides of GStreamer */
+	if (planar) {
+		self->input.stride[0] = rowstride ? rowstride : ROUND_UP(width, 4);
+		if (format == GST_MAKE_FOURCC('N', 'V', '1', '2'))
+			self->input.stride[1] = self->input.stride[0];
+		else
+			self->input.stride[1] = rowstride ? rowstride / 2 : ROUND_UP(width / 2, 4);
+		size = self->input.stride[0] * ROUND_UP(height, 2);
+		if (format == GST_MAKE_FOURCC('N', 'V', '1', '2'))
+			size += self->input.stride[1] * height / 2;
+		else
+			size += self->input.stride[1] * ROUND_UP(height, 2);
+	} else {
+		self->input.stride[0] = rowstride ? rowstride : ROUND_UP(width * 2, 4);
+		self->input.stride[1] = 0;
+		size = self->input.stride[0] * height;
+	}
+	self->input.size = size;
+
+	if (format == self->color_format &&
+			self->input.stride[0] == (guint) (planar ? width : width * 2) &&
+			(!planar || self->input.stride[1] == (guint) width / 2))
+	{
+		base->convert_buffer = NULL;
+		if (base->alg != GSTDSP_JPEGENC)
+			base->input_buffer_size = 0;
+		return;
+	}
+
+	pr_info(self, "converting %" GST_FOURCC_FORMAT ", stride %u",
+		GST_FOURCC_ARGS(format), self->input.stride[0]);
+
+	base->convert_buffer = convert_buffer;
+	if (base->alg != GSTDSP_JPEGENC)
+		base->input_buffer_size = width * height * (planar ? 3 : 4) / 2;
+}
+
 static gboolean
 sink_setcaps(GstPad *pad,
 	     GstCaps *caps)
@@ -310,7 +453,7 @@ sink_setcaps(GstPad *pad,
 		gst_structure_set(out_struc, "width", G_TYPE_INT, width, NULL);
 	if (gst_structure_get_int(in_struc, "height", &height))
 		gst_structure_set(out_struc, "height", G_TYPE_INT, height, NULL);
-	gst_structure_get_fourcc(in_struc, "format", &self->color_format);
+	setup_input(self, in_struc, width, height);
 
 	switch (base->alg) {
 	case GSTDSP_H263ENC:
@@ -374,10 +517,12 @@ sink_setcaps(GstPad *pad,
 
 	check_supported_levels(self, tgt_level);
 
-	if (self->bitrate == 0)
-		self->bitrate = self->max_bitrate;
-	else if (self->bitrate > self->max_bitrate)
+	/* not what adaptive bitrate might have lowered it to */
+	if (self->user_bitrate == 0 || self->user_bitrate > self->max_bitrate)
 		self->bitrate = self->max_bitrate;
+	else
+		self->bitrate = self->user_bitrate;
+	self->abr.target = self->bitrate;
 
 	gst_caps_append_structure(out_caps, out_struc);
 
@@ -419,10 +564,19 @@ sink_setcaps(GstPad *pad,
 		return TRUE;
 
 	switch (base->alg) {
-	case GSTDSP_JPEGENC:
-		du_port_alloc_buffers(base->ports[0], 1);
-		du_port_alloc_buffers(base->ports[1], 2);
+	case GSTDSP_JPEGENC: {
+		/*
+		 * In burst mode the next images are queued while the current
+		 * one is being encoded, so the DSP goes from one to the other
+		 * without waiting for the ARM side. This is one node with a
+		 * deeper queue rather than several nodes fed in turn: they would
+		 * all share the one DSP core, each with maximum-size buffers.
+		 */
+		guint burst = MAX(self->burst, 1);
+		du_port_alloc_buffers(base->ports[0], burst);
+		du_port_alloc_buffers(base->ports[1], burst + 1);
 		break;
+	}
 	case GSTDSP_HDMP4VENC:
 	case GSTDSP_HDH264ENC:
 		du_port_alloc_buffers(base->ports[0], 6);
@@ -454,6 +608,104 @@ sink_setcaps(GstPad *pad,
 	return TRUE;
 }
 
+/*
+ * Keyframe requests go from the element threads, to the input path, to the
+ * output path, without locks. The event is pushed right before the keyframe
+ * it caused; it carries the timestamp of the frame that was asked to be one.
+ */
+
+static inline GstEvent *
+keyframe_exchange(GstEvent **slot,
+		  GstEvent *event)
+{
+	GstEvent *old;
+
+	do {
+		old = g_atomic_pointer_get((gpointer *) slot);
+	} while (!g_atomic_pointer_compare_and_exchange((gpointer *) slot, old, event));
+
+	return old;
+}
+
+static void
+keyframe_request(GstDspVEnc *self,
+		 GstEvent *event)
+{
+	GstEvent *old;
+
+	old = keyframe_exchange(&self->keyframe_event, event);
+	if (old)
+		gst_event_unref(old);
+}
+
+gboolean
+gstdsp_venc_keyframe_pending(GstDspBase *base,
+			     struct td_buffer *tb)
+{
+	GstDspVEnc *self = GST_DSP_VENC(base);
+	GstEvent *event, *old;
+
+	if (G_LIKELY(!g_atomic_pointer_get((gpointer *) &self->keyframe_event)))
+		return FALSE;
+
+	event = keyframe_exchange(&self->keyframe_event, NULL);
+	if (!event)
+		return FALSE;
+
+	event = GST_EVENT(gst_mini_object_make_writable(GST_MINI_OBJECT(event)));
+	GST_EVENT_TIMESTAMP(event) = base->ts_array[tb->data->ts_index].time;
+
+	/* a previous one still on its way gets merged */
+	old = keyframe_exchange(&self->keyframe_out, event);
+	if (old)
+		gst_event_unref(old);
+
+	return TRUE;
+}
+
+static void
+keyframe_push(GstDspVEnc *self,
+	      GstBuffer *buf)
+{
+	GstDspBase *base = GST_DSP_BASE(self);
+	GstEvent *event;
+	GstClockTime ts;
+
+	if (G_LIKELY(!g_atomic_pointer_get((gpointer *) &self->keyframe_out)))
+		return;
+
+	if (GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT))
+		return;
+
+	event = keyframe_exchange(&self->keyframe_out, NULL);
+	if (!event)
+		return;
+
+	ts = GST_EVENT_TIMESTAMP(event);
+
+	/* an earlier keyframe of its own */
+	if (GST_CLOCK_TIME_IS_VALID(ts) && GST_BUFFER_TIMESTAMP_IS_VALID(buf) &&
+			GST_BUFFER_TIMESTAMP(buf) < ts) {
+		/* put it back, unless a newer one took its place */
+		if (!g_atomic_pointer_compare_and_exchange((gpointer *) &self->keyframe_out, NULL, event))
+			gst_event_unref(event);
+		return;
+	}
+
+	gst_pad_push_event(base->srcpad, event);
+}
+
+/* its keyframe is not coming */
+static void
+keyframe_clear(GstDspVEnc *self)
+{
+	GstEvent *event;
+
+	event = keyframe_exchange(&self->keyframe_out, NULL);
+	if (event)
+		gst_event_unref(event);
+}
+
 static gboolean
 sink_event(GstDspBase *base,
 	   GstEvent *event)
@@ -467,15 +719,15 @@ sink_event(GstDspBase *base,
 			s = gst_event_get_structure(event);
 
 			if (gst_structure_has_name(s, "GstForceKeyUnit")) {
-				g_mutex_lock(self->keyframe_mutex);
-				if (self->keyframe_event)
-					gst_event_unref(self->keyframe_event);
-				self->keyframe_event = event;
-				g_mutex_unlock(self->keyframe_mutex);
+				keyframe_request(self, event);
 				return TRUE;
 			}
 			break;
 		}
+	case GST_EVENT_FLUSH_START:
+	case GST_EVENT_FLUSH_STOP:
+		keyframe_clear(self);
+		break;
 	default:
 		break;
 	}
@@ -499,17 +751,25 @@ src_event(GstDspBase *base,
 			s = gst_event_get_structure(event);
 
 			if (gst_structure_has_name(s, "GstForceKeyUnit")) {
-				g_mutex_lock(self->keyframe_mutex);
 				/* make it downstream */
 				GST_EVENT_TYPE(event) = GST_EVENT_CUSTOM_DOWNSTREAM;
-				if (self->keyframe_event)
-					gst_event_unref(self->keyframe_event);
-				self->keyframe_event = event;
-				g_mutex_unlock(self->keyframe_mutex);
+				keyframe_request(self, event);
 				return TRUE;
 			}
 			break;
 		}
+	case GST_EVENT_QOS:
+		{
+			gdouble proportion;
+			GstClockTimeDiff diff;
+			GstClockTime timestamp;
+
+			gst_event_parse_qos(event, &proportion, &diff, &timestamp);
+			/* downstream is late */
+			if (diff > 0)
+				g_atomic_int_set(&self->abr.congested, 1);
+			break;
+		}
 	default:
 		break;
 	}
@@ -520,6 +780,155 @@ src_event(GstDspBase *base,
 	return gst_pad_push_event(base->sinkpad, event);
 }
 
+/*
+ * The encoders report what they know about each frame from out_recv_cb(),
+ * by output buffer; it's picked up when the buffer is pushed.
+ */
+void
+gstdsp_venc_set_frame_info(GstDspBase *base,
+			   struct td_buffer *tb,
+			   gint type,
+			   guint units,
+			   gint error)
+{
+	GstDspVEnc *self = GST_DSP_VENC(base);
+	struct venc_frame_info *info;
+	unsigned i = tb - base->ports[1]->buffers;
+
+	if (i >= ARRAY_SIZE(self->frame_info))
+		return;
+
+	info = &self->frame_info[i];
+	info->data = tb->data->data;
+	info->type = type;
+	info->units = units;
+	info->error = error;
+}
+
+static struct venc_frame_info *
+find_frame_info(GstDspVEnc *self,
+		GstBuffer *buf)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(self->frame_info); i++)
+		if (self->frame_info[i].data == GST_BUFFER_DATA(buf))
+			return &self->frame_info[i];
+
+	return NULL;
+}
+
+static void
+frame_stats(GstDspVEnc *self,
+	    GstBuffer *buf)
+{
+	struct venc_frame_info *info;
+	gboolean keyframe;
+	guint size;
+
+	info = find_frame_info(self, buf);
+
+	keyframe = !GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT);
+	size = GST_BUFFER_SIZE(buf);
+
+	g_mutex_lock(self->stats_mutex);
+	self->stats.frames++;
+	if (keyframe)
+		self->stats.keyframes++;
+	self->stats.bytes += size;
+	if (size > self->stats.max_size)
+		self->stats.max_size = size;
+	if (GST_BUFFER_DURATION_IS_VALID(buf))
+		self->stats.duration += GST_BUFFER_DURATION(buf);
+	if (info && info->error) {
+		self->stats.errors++;
+		self->stats.last_error = info->error;
+	}
+	g_mutex_unlock(self->stats_mutex);
+
+	if (self->frame_messages) {
+		GstStructure *s;
+
+		s = gst_structure_new("dspvenc-frame",
+				      "timestamp", G_TYPE_UINT64, GST_BUFFER_TIMESTAMP(buf),
+				      "duration", G_TYPE_UINT64, GST_BUFFER_DURATION(buf),
+				      "size", G_TYPE_UINT, size,
+				      "keyframe", G_TYPE_BOOLEAN, keyframe,
+				      "bitrate", G_TYPE_INT, g_atomic_int_get(&self->bitrate),
+				      NULL);
+		if (info)
+			gst_structure_set(s,
+					  "frame-type", G_TYPE_INT, info->type,
+					  "units", G_TYPE_UINT, info->units,
+					  "error", G_TYPE_INT, info->error,
+					  NULL);
+
+		gst_element_post_message(GST_ELEMENT(self),
+					 gst_message_new_element(GST_OBJECT(self), s));
+	}
+
+	/* consumed */
+	if (info)
+		info->data = NULL;
+}
+
+/*
+ * No input buffer got free in time. The frame never reaches the DSP, so a
+ * pending keyframe request stays for the next one, and it doesn't take a
+ * timestamp slot; only the frame index moves on, as it counts input frames.
+ */
+static void
+drop_buffer(GstDspBase *base,
+	    GstBuffer *buf)
+{
+	GstDspVEnc *self = GST_DSP_VENC(base);
+
+	g_atomic_int_inc(&self->frame_index);
+
+	g_mutex_lock(self->stats_mutex);
+	self->stats.dropped++;
+	g_mutex_unlock(self->stats_mutex);
+
+	if (self->frame_messages) {
+		GstStructure *s;
+
+		s = gst_structure_new("dspvenc-drop",
+				      "timestamp", G_TYPE_UINT64, GST_BUFFER_TIMESTAMP(buf),
+				      "duration", G_TYPE_UINT64, GST_BUFFER_DURATION(buf),
+				      NULL);
+		gst_element_post_message(GST_ELEMENT(self),
+					 gst_message_new_element(GST_OBJECT(self), s));
+	}
+}
+
+static GstStructure *
+get_stats(GstDspVEnc *self)
+{
+	GstStructure *s;
+	guint64 bitrate = 0;
+
+	g_mutex_lock(self->stats_mutex);
+	if (self->stats.duration)
+		bitrate = self->stats.bytes * 8 * GST_SECOND / self->stats.duration;
+	s = gst_structure_new("dspvenc-stats",
+			      "frames", G_TYPE_UINT, self->stats.frames,
+			      "keyframes", G_TYPE_UINT, self->stats.keyframes,
+			      "bytes", G_TYPE_UINT64, self->stats.bytes,
+			      "avg-size", G_TYPE_UINT,
+			      self->stats.frames ? (guint) (self->stats.bytes / self->stats.frames) : 0,
+			      "max-size", G_TYPE_UINT, self->stats.max_size,
+			      "actual-bitrate", G_TYPE_UINT64, bitrate,
+			      "bitrate", G_TYPE_INT, g_atomic_int_get(&self->bitrate),
+			      "dropped", G_TYPE_UINT, self->stats.dropped,
+			      "overflows", G_TYPE_UINT, self->stats.overflows,
+			      "errors", G_TYPE_UINT, self->stats.errors,
+			      "last-error", G_TYPE_INT, self->stats.last_error,
+			      NULL);
+	g_mutex_unlock(self->stats_mutex);
+
+	return s;
+}
+
 static void
 set_property(GObject *obj,
 	     guint prop_id,
@@ -532,9 +941,11 @@ set_property(GObject *obj,
 	case ARG_BITRATE: {
 		guint bitrate;
 		bitrate = g_value_get_uint(value);
+		self->user_bitrate = bitrate;
 		if (self->max_bitrate && bitrate > (unsigned) self->max_bitrate)
 			bitrate = self->max_bitrate;
 		g_atomic_int_set(&self->bitrate, bitrate);
+		self->abr.target = bitrate;
 		break;
 	}
 	case ARG_MODE:
@@ -554,6 +965,26 @@ set_property(GObject *obj,
 		self->intra_refresh = g_value_get_boolean(value);
 		self->intra_refresh_set = true;
 		break;
+	case ARG_ADAPTIVE_BITRATE:
+		self->abr.enabled = g_value_get_boolean(value);
+		break;
+	case ARG_MIN_BITRATE:
+		self->abr.min_bitrate = g_value_get_uint(value);
+		break;
+	case ARG_ADAPTIVE_KEYFRAMES:
+		self->abr.keyframes = g_value_get_boolean(value);
+		break;
+	case ARG_ADAPTIVE_PUSH_TIME:
+		self->abr.push_time = g_value_get_boolean(value);
+		break;
+	case ARG_FRAME_MESSAGES:
+		self->frame_messages = g_value_get_boolean(value);
+		break;
+	case ARG_INPUT_TIMEOUT: {
+		GstDspBase *base = GST_DSP_BASE(obj);
+		base->input_timeout = g_value_get_uint(value);
+		break;
+	}
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
 		break;
@@ -590,12 +1021,452 @@ get_property(GObject *obj,
 	case ARG_INTRA_REFRESH:
 		g_value_set_boolean(value, self->intra_refresh);
 		break;
+	case ARG_ADAPTIVE_BITRATE:
+		g_value_set_boolean(value, self->abr.enabled);
+		break;
+	case ARG_MIN_BITRATE:
+		g_value_set_uint(value, self->abr.min_bitrate);
+		break;
+	case ARG_ADAPTIVE_KEYFRAMES:
+		g_value_set_boolean(value, self->abr.keyframes);
+		break;
+	case ARG_ADAPTIVE_PUSH_TIME:
+		g_value_set_boolean(value, self->abr.push_time);
+		break;
+	case ARG_FRAME_MESSAGES:
+		g_value_set_boolean(value, self->frame_messages);
+		break;
+	case ARG_STATS:
+		g_value_take_boxed(value, get_stats(self));
+		break;
+	case ARG_INPUT_TIMEOUT: {
+		GstDspBase *base = GST_DSP_BASE(obj);
+		g_value_set_uint(value, base->input_timeout);
+		break;
+	}
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, prop_id, pspec);
 		break;
 	}
 }
 
+/*
+ * The static output sizes are worst case guesses; e.g. for 720p that's
+ * ~460KiB per buffer, while the frames are typically 10-40KiB. Learn the
+ * real sizes from what the DSP returns and resize the pinned buffers as
+ * they are recycled, so they always go straight back to the DSP.
+ */
+
+#define OUT_SIZE_MIN_DELTAS 8
+
+static void
+out_size_reset(GstDspVEnc *self)
+{
+	self->out_size.peak[0] = self->out_size.peak[1] = 0;
+	self->out_size.count[0] = self->out_size.count[1] = 0;
+	self->out_size.bitrate = 0;
+}
+
+static void
+request_keyframe(GstDspVEnc *self)
+{
+	GstStructure *s;
+	GstEvent *event;
+
+	if (g_atomic_pointer_get((gpointer *) &self->keyframe_event))
+		return;
+
+	s = gst_structure_new("GstForceKeyUnit", NULL);
+	event = gst_event_new_custom(GST_EVENT_CUSTOM_DOWNSTREAM, s);
+
+	/* an external one might have come in the meantime */
+	if (!g_atomic_pointer_compare_and_exchange((gpointer *) &self->keyframe_event, NULL, event))
+		gst_event_unref(event);
+}
+
+static void
+out_size_observe(GstDspVEnc *self,
+		 struct td_buffer *tb)
+{
+	GstDspBase *base = GST_DSP_BASE(self);
+	dmm_buffer_t *b = tb->data;
+	unsigned type = tb->keyframe ? 1 : 0;
+	guint peak;
+	gint bitrate;
+
+	if (tb->full) {
+		/*
+		 * The frame was most likely truncated, and the input is gone
+		 * by now, so it can't be encoded again; grow back to the worst
+		 * case, even beyond if that was not enough.
+		 */
+		if (b->size >= self->out_size.max)
+			self->out_size.max = ROUND_UP(b->size * 2, PAGE_SIZE);
+		out_size_reset(self);
+		/* the references are broken */
+		if (base->alg != GSTDSP_JPEGENC)
+			request_keyframe(self);
+		return;
+	}
+
+	/* keep the observations relative to the bitrate they were made at */
+	bitrate = g_atomic_int_get(&self->bitrate);
+	if (self->out_size.bitrate && bitrate > self->out_size.bitrate) {
+		unsigned i;
+		for (i = 0; i < 2; i++)
+			self->out_size.peak[i] = (guint64) self->out_size.peak[i] *
+				bitrate / self->out_size.bitrate;
+	}
+	self->out_size.bitrate = bitrate;
+
+	/* slowly decaying peak */
+	peak = self->out_size.peak[type];
+	peak -= peak / 32;
+	self->out_size.peak[type] = MAX(b->len, peak);
+	self->out_size.count[type]++;
+}
+
+static guint
+out_size_get(GstDspVEnc *self)
+{
+	GstDspBase *base = GST_DSP_BASE(self);
+	guint size;
+
+	/*
+	 * There's no telling how big the next still is going to be, and an
+	 * overflow loses the whole image; stay at the worst case.
+	 */
+	if (base->alg == GSTDSP_JPEGENC)
+		return self->out_size.max;
+
+	if (!self->out_size.count[1] ||
+			self->out_size.count[0] < OUT_SIZE_MIN_DELTAS)
+		return self->out_size.max;
+
+	/* any buffer might get a keyframe; 50% headroom */
+	size = MAX(self->out_size.peak[0], self->out_size.peak[1]);
+	size = ROUND_UP(size + size / 2, PAGE_SIZE);
+
+	return MIN(size, self->out_size.max);
+}
+
+/* the size an output buffer should be reallocated to, or 0 to keep it */
+static guint
+out_size_check(GstDspVEnc *self,
+	       struct td_buffer *tb)
+{
+	GstDspBase *base = GST_DSP_BASE(self);
+	dmm_buffer_t *b = tb->data;
+	guint size;
+
+	g_mutex_lock(self->out_size_mutex);
+	if (self->out_size.max < base->output_buffer_size)
+		self->out_size.max = base->output_buffer_size;
+	/* clean buffers haven't been through the DSP yet */
+	if (!tb->clean && b->len)
+		out_size_observe(self, tb);
+	size = out_size_get(self);
+	g_mutex_unlock(self->out_size_mutex);
+
+	/* hysteresis; don't shrink for small differences */
+	if (b->size >= size && b->size <= size * 2)
+		return 0;
+
+	return size;
+}
+
+static GstFlowReturn
+send_buffer(GstDspBase *base,
+	    struct td_buffer *tb)
+{
+	GstDspVEnc *self = GST_DSP_VENC(base);
+	dmm_buffer_t *b = tb->data;
+	guint size;
+
+	if (tb->port == base->ports[0] || !tb->pinned)
+		goto leave;
+
+	/* not a recycled buffer, nobody else is waiting on the pool */
+	size = out_size_check(self, tb);
+	if (size) {
+		pr_debug(self, "resizing output buffer %zu -> %u", b->size, size);
+		dmm_buffer_allocate(b, size);
+		dmm_buffer_map(b);
+		tb->clean = true;
+	}
+
+leave:
+	return self->base_send_buffer(base, tb);
+}
+
+/*
+ * Released output buffers come back from a downstream thread; the new one
+ * is allocated and mapped without the pool lock, and swapped in as long as
+ * the ports haven't been set up again in the meantime.
+ */
+static void
+recycle_buffer(GstDspBase *base,
+	       struct td_buffer *tb,
+	       gint cycle)
+{
+	GstDspVEnc *self = GST_DSP_VENC(base);
+	dmm_buffer_t *b, *old;
+	guint size;
+	int dir;
+
+	g_mutex_lock(base->pool_mutex);
+	if (base->cycle != cycle)
+		goto leave;
+
+	size = out_size_check(self, tb);
+	if (!size) {
+		self->base_send_buffer(base, tb);
+		goto leave;
+	}
+	dir = tb->data->dir;
+	g_mutex_unlock(base->pool_mutex);
+
+	pr_debug(self, "resizing output buffer -> %u", size);
+	b = dmm_buffer_new(base->dsp_handle, base->proc, dir);
+	dmm_buffer_allocate(b, size);
+	dmm_buffer_map(b);
+
+	g_mutex_lock(base->pool_mutex);
+	if (base->cycle != cycle) {
+		g_mutex_unlock(base->pool_mutex);
+		dmm_buffer_free(b);
+		return;
+	}
+	old = tb->data;
+	tb->data = b;
+	tb->clean = true;
+	self->base_send_buffer(base, tb);
+	g_mutex_unlock(base->pool_mutex);
+
+	dmm_buffer_free(old);
+	return;
+
+leave:
+	g_mutex_unlock(base->pool_mutex);
+}
+
+/* split avc output into one buffer per NAL unit, e.g. for RTP payloaders */
+static GstFlowReturn
+push_nal_list(GstDspBase *base,
+	      GstBuffer *buf)
+{
+#if GST_CHECK_VERSION(0, 10, 24)
+	GstDspVEnc *self = GST_DSP_VENC(base);
+	GstBufferList *list;
+	GstBufferListIterator *it;
+	guint8 *data;
+	guint offset = 0, size, len;
+
+	if (base->alg != GSTDSP_H264ENC && base->alg != GSTDSP_HDH264ENC)
+		goto push;
+
+	if (!self->priv.h264.buffer_list || self->priv.h264.bytestream)
+		goto push;
+
+	data = GST_BUFFER_DATA(buf);
+	size = GST_BUFFER_SIZE(buf);
+
+	list = gst_buffer_list_new();
+	it = gst_buffer_list_iterate(list);
+
+	while (offset + 4 < size) {
+		GstBuffer *sub;
+
+		/* the length prefixes are in place already */
+		len = GST_READ_UINT32_BE(data + offset) + 4;
+		if (len > size - offset) {
+			pr_warning(self, "bad NAL length at %u", offset);
+			break;
+		}
+
+		sub = gst_buffer_create_sub(buf, offset, len);
+		gst_buffer_copy_metadata(sub, buf, GST_BUFFER_COPY_ALL);
+		gst_buffer_list_iterator_add_group(it);
+		gst_buffer_list_iterator_add(it, sub);
+		offset += len;
+	}
+
+	gst_buffer_list_iterator_free(it);
+	gst_buffer_unref(buf);
+
+	return gst_pad_push_list(base->srcpad, list);
+
+push:
+#endif
+	return gst_pad_push(base->srcpad, buf);
+}
+
+/*
+ * Adaptive bitrate: the output is measured over windows of one second of
+ * stream time. Downstream is considered congested when it sends QoS events
+ * saying it's late; then the bitrate is cut by a quarter. When the output
+ * is over the target, the bitrate is scaled down by as much. After a few
+ * calm windows it's raised again in small steps, up to the target.
+ *
+ * Pushes that block are normal for sinks that sync and for muxers, so
+ * taking them as congestion is only done when asked for.
+ */
+
+#define ABR_WINDOW GST_SECOND
+#define ABR_CALM_WINDOWS 3
+
+static inline GstClockTime
+get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return GST_TIMESPEC_TO_TIME(ts);
+}
+
+static void
+abr_reset(GstDspVEnc *self)
+{
+	self->abr.bytes = 0;
+	self->abr.duration = 0;
+	self->abr.calm = 0;
+	g_atomic_int_set(&self->abr.congested, 0);
+}
+
+static void
+abr_update(GstDspVEnc *self,
+	   guint size,
+	   GstClockTime duration,
+	   GstClockTime push_time)
+{
+	GstDspBase *base = GST_DSP_BASE(self);
+	gint bitrate, new_bitrate, target, min;
+	guint64 actual;
+	gboolean congested;
+
+	if (!GST_CLOCK_TIME_IS_VALID(duration))
+		duration = self->framerate ? GST_SECOND / self->framerate : 0;
+
+	if (self->abr.push_time && duration && push_time > duration / 2)
+		g_atomic_int_set(&self->abr.congested, 1);
+
+	self->abr.bytes += size;
+	self->abr.duration += duration;
+	if (self->abr.duration < ABR_WINDOW)
+		return;
+
+	bitrate = new_bitrate = g_atomic_int_get(&self->bitrate);
+	target = self->abr.target;
+	min = self->abr.min_bitrate ? (gint) self->abr.min_bitrate : target / 8;
+	actual = self->abr.bytes * 8 * GST_SECOND / self->abr.duration;
+	congested = g_atomic_int_compare_and_exchange(&self->abr.congested, 1, 0);
+
+	if (congested) {
+		new_bitrate = bitrate - bitrate / 4;
+		self->abr.calm = 0;
+	} else if (actual > (guint64) target) {
+		/* the encoder is overshooting; the link might not take it */
+		new_bitrate = (guint64) bitrate * target / actual;
+		self->abr.calm = 0;
+	} else if (++self->abr.calm >= ABR_CALM_WINDOWS) {
+		new_bitrate = bitrate + target / 20;
+		self->abr.calm = 0;
+	}
+
+	new_bitrate = CLAMP(new_bitrate, min, target);
+
+	if (new_bitrate != bitrate) {
+		pr_info(self, "bitrate %d -> %d (actual %" G_GUINT64_FORMAT ")",
+				bitrate, new_bitrate, actual);
+		g_atomic_int_set(&self->bitrate, new_bitrate);
+		/* receivers might have lost data */
+		if (congested && self->abr.keyframes && base->alg != GSTDSP_JPEGENC)
+			request_keyframe(self);
+	}
+
+	self->abr.bytes = 0;
+	self->abr.duration = 0;
+}
+
+/*
+ * A frame that filled the whole buffer was most likely truncated; it's
+ * dropped and the next one is marked as a discontinuity. The input is gone
+ * by now, so it can't be encoded again.
+ */
+static gboolean
+check_overflow(GstDspVEnc *self,
+	       GstBuffer *buf)
+{
+	struct td_buffer *tb;
+	struct venc_frame_info *info;
+	GError *gerror;
+
+	tb = gst_dsp_buffer_get_td(buf);
+	if (G_LIKELY(!tb || !tb->full)) {
+		if (G_UNLIKELY(self->out_size.discont)) {
+			GST_BUFFER_FLAG_SET(buf, GST_BUFFER_FLAG_DISCONT);
+			self->out_size.discont = FALSE;
+		}
+		return FALSE;
+	}
+
+	pr_warning(self, "output buffer overflow (%zu bytes), dropping frame",
+		   tb->data->size);
+	gerror = g_error_new(GST_STREAM_ERROR, GST_STREAM_ERROR_ENCODE,
+			     "output buffer overflow, frame %" GST_TIME_FORMAT " dropped",
+			     GST_TIME_ARGS(GST_BUFFER_TIMESTAMP(buf)));
+	gst_element_post_message(GST_ELEMENT(self),
+				 gst_message_new_warning(GST_OBJECT(self), gerror, NULL));
+	g_error_free(gerror);
+
+	g_mutex_lock(self->stats_mutex);
+	self->stats.overflows++;
+	g_mutex_unlock(self->stats_mutex);
+
+	info = find_frame_info(self, buf);
+	if (info)
+		info->data = NULL;
+
+	self->out_size.discont = TRUE;
+	gst_buffer_unref(buf);
+
+	return TRUE;
+}
+
+static GstFlowReturn
+push_buffer(GstDspBase *base,
+	    GstBuffer *buf)
+{
+	GstDspVEnc *self = GST_DSP_VENC(base);
+	GstClockTime duration, start;
+	GstFlowReturn ret;
+	guint size;
+
+	keyframe_push(self, buf);
+
+	if (G_UNLIKELY(check_overflow(self, buf)))
+		return GST_FLOW_OK;
+
+	frame_stats(self, buf);
+
+	if (!self->abr.enabled || !self->abr.target)
+		return push_nal_list(base, buf);
+
+	size = GST_BUFFER_SIZE(buf);
+	duration = GST_BUFFER_DURATION(buf);
+
+	if (!self->abr.push_time) {
+		ret = push_nal_list(base, buf);
+		abr_update(self, size, duration, 0);
+		return ret;
+	}
+
+	start = get_time();
+	ret = push_nal_list(base, buf);
+	abr_update(self, size, duration, get_time() - start);
+
+	return ret;
+}
+
 static void
 reset(GstDspBase *base)
 {
@@ -603,15 +1474,27 @@ reset(GstDspBase *base)
 
 	pr_debug(self, "venc reset");
 
+	g_mutex_lock(self->out_size_mutex);
+	out_size_reset(self);
+	self->out_size.max = 0;
+	g_mutex_unlock(self->out_size_mutex);
+	self->out_size.discont = FALSE;
+
+	abr_reset(self);
+
+	g_mutex_lock(self->stats_mutex);
+	memset(&self->stats, 0, sizeof(self->stats));
+	g_mutex_unlock(self->stats_mutex);
+	memset(self->frame_info, 0, sizeof(self->frame_info));
+
+	keyframe_clear(self);
+
 	/* some cleanup */
 	if (base->alg == GSTDSP_H264ENC || base->alg == GSTDSP_HDH264ENC) {
 		self->priv.h264.codec_data_done = FALSE;
-		self->priv.h264.sps_received = FALSE;
-		self->priv.h264.pps_received = FALSE;
-		gst_buffer_replace(&self->priv.h264.sps, NULL);
-		gst_buffer_replace(&self->priv.h264.pps, NULL);
+		self->priv.h264.nr_sps = self->priv.h264.nr_pps = 0;
 		gst_buffer_replace(&self->priv.h264.codec_data, NULL);
-	} else {
+	} else if (base->alg != GSTDSP_JPEGENC) {
 		self->priv.mpeg4.codec_data_done = FALSE;
 		self->priv.mpeg4.vbv_size = 0;
 	}
@@ -626,22 +1509,31 @@ instance_init(GTypeInstance *instance,
 
 	gst_pad_set_setcaps_function(base->sinkpad, sink_setcaps);
 	base->reset = reset;
+	base->push_buffer = push_buffer;
+	base->drop_buffer = drop_buffer;
+	self->base_send_buffer = base->send_buffer;
+	base->send_buffer = send_buffer;
+	base->recycle_buffer = recycle_buffer;
 
-	self->bitrate = DEFAULT_BITRATE;
+	self->bitrate = self->user_bitrate = DEFAULT_BITRATE;
 	self->mode = DEFAULT_MODE;
 	self->keyframe_interval = DEFAULT_KEYFRAME_INTERVAL;
 	self->intra_refresh = DEFAULT_INTRA_REFRESH;
 
-	self->keyframe_mutex = g_mutex_new();
+	self->out_size_mutex = g_mutex_new();
+	self->stats_mutex = g_mutex_new();
 }
 
 static void
 finalize(GObject *obj)
 {
 	GstDspVEnc *self = GST_DSP_VENC(obj);
-	g_mutex_free(self->keyframe_mutex);
+	g_mutex_free(self->out_size_mutex);
+	g_mutex_free(self->stats_mutex);
 	if (self->keyframe_event)
 		gst_event_unref(self->keyframe_event);
+	if (self->keyframe_out)
+		gst_event_unref(self->keyframe_out);
 	G_OBJECT_CLASS(parent_class)->finalize(obj);
 }
 
@@ -704,6 +1596,47 @@ class_init(gpointer g_class,
 							     "Whether or not to use periodic intra-refresh",
 							     DEFAULT_INTRA_REFRESH, G_PARAM_READWRITE));
 
+	g_object_class_install_property(gobject_class, ARG_ADAPTIVE_BITRATE,
+					g_param_spec_boolean("adaptive-bitrate", "Adaptive bit-rate",
+							     "Lower the bit-rate when downstream can't keep up, "
+							     "and raise it back up to 'bitrate' when it can",
+							     DEFAULT_ADAPTIVE_BITRATE, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, ARG_MIN_BITRATE,
+					g_param_spec_uint("min-bitrate", "Minimum Bit-rate",
+							  "Minimum adaptive bit-rate (0 for 1/8 of 'bitrate')",
+							  0, G_MAXUINT, DEFAULT_MIN_BITRATE,
+							  G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, ARG_ADAPTIVE_KEYFRAMES,
+					g_param_spec_boolean("adaptive-keyframes", "Adaptive keyframes",
+							     "Request a keyframe when backing off from congestion",
+							     DEFAULT_ADAPTIVE_KEYFRAMES, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, ARG_ADAPTIVE_PUSH_TIME,
+					g_param_spec_boolean("adaptive-push-time", "Adaptive push time",
+							     "Also take a push blocking for over half a frame as congestion; "
+							     "only for downstream that doesn't sync or mux, "
+							     "e.g. a leaky queue in front of a network sink",
+							     DEFAULT_ADAPTIVE_PUSH_TIME, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, ARG_FRAME_MESSAGES,
+					g_param_spec_boolean("frame-messages", "Frame messages",
+							     "Post an element message for every encoded frame",
+							     DEFAULT_FRAME_MESSAGES, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, ARG_STATS,
+					g_param_spec_boxed("stats", "Statistics",
+							   "Running statistics of the encoded frames",
+							   GST_TYPE_STRUCTURE, G_PARAM_READABLE));
+
+	g_object_class_install_property(gobject_class, ARG_INPUT_TIMEOUT,
+					g_param_spec_uint("input-timeout", "Input timeout",
+							  "Drop input frames when the DSP doesn't take them "
+							  "within this time (ms, 0 to wait); for live sources",
+							  0, G_MAXUINT, DEFAULT_INPUT_TIMEOUT,
+							  G_PARAM_READWRITE));
+
 	gobject_class->finalize = finalize;
 
 	base_class->src_event = src_event;
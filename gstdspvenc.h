@@ -27,9 +27,12 @@ typedef struct _GstDspVEncClass GstDspVEncClass;
 union venc_priv_data {
 	struct {
 		gboolean bytestream;
-		gboolean sps_received, pps_received, codec_data_done;
-		GstBuffer *sps, *pps, *codec_data;
+		gboolean codec_data_done;
+		GstBuffer *codec_data; /* avcC being built */
+		guint nr_sps, nr_pps;
+		guint sps_end;
 		guint slice_size_mb;
+		gboolean buffer_list; /* one buffer per NAL unit */
 		gint idr_interval;
 		GstClockTime last_idr;
 	} h264;
@@ -39,6 +42,16 @@ union venc_priv_data {
 	} mpeg4;
 };
 
+#define VENC_MAX_FRAME_INFO 8
+
+/* what the DSP said about the frame in an output buffer */
+struct venc_frame_info {
+	void *data;
+	gint type;
+	guint units; /* NAL units, or video packets */
+	gint error;
+};
+
 struct gstdsp_codec_level {
 	gint id;
 	gint mbpf; /* macroblock per frame */
@@ -62,21 +75,69 @@ struct _GstDspVEnc {
 	guint32 color_format;
 	gint max_bitrate;
 	gint bitrate;
+	gint user_bitrate;
 	gint user_max_bitrate;
 	gint framerate;
 	gint quality;
 	struct gstdsp_codec_level *supported_levels;
 	guint nr_supported_levels;
 	union venc_priv_data priv;
+	guint burst; /* jpeg: images in flight */
 	gint frame_index;
-	GstEvent *keyframe_event;
-	GMutex *keyframe_mutex;
+
+	/* layout of the frames from upstream, when it's not what the DSP takes */
+	struct {
+		guint32 format;
+		guint stride[2]; /* luma or packed, chroma */
+		gsize size;
+	} input;
+
+	/* keyframe requests; only exchanged atomically */
+	GstEvent *keyframe_event; /* not yet sent */
+	GstEvent *keyframe_out; /* waiting for its keyframe to come out */
 	gint mode;
 	gint keyframe_interval;
 	gboolean intra_refresh;
 	bool intra_refresh_set;
 	gint level;
 	guint gob_length;
+
+	/* pinned output buffer sizing from the observed frame sizes */
+	GstFlowReturn (*base_send_buffer)(GstDspBase *base, struct td_buffer *tb);
+	GMutex *out_size_mutex;
+	struct {
+		guint max; /* worst case */
+		guint peak[2]; /* delta, key */
+		guint count[2];
+		gint bitrate;
+		gboolean discont;
+	} out_size;
+
+	/* adaptive bitrate */
+	struct {
+		gboolean enabled;
+		gboolean keyframes;
+		gboolean push_time; /* blocking pushes are congestion */
+		guint min_bitrate;
+		gint target; /* the ceiling; requested, or from the level */
+		guint64 bytes;
+		GstClockTime duration;
+		gint congested;
+		guint calm; /* windows without congestion */
+	} abr;
+
+	/* per-frame statistics */
+	struct venc_frame_info frame_info[VENC_MAX_FRAME_INFO];
+	gboolean frame_messages;
+	GMutex *stats_mutex;
+	struct {
+		guint frames, keyframes, errors, dropped;
+		guint overflows;
+		guint64 bytes;
+		guint max_size;
+		GstClockTime duration;
+		gint last_error;
+	} stats;
 };
 
 struct _GstDspVEncClass {
@@ -85,6 +146,10 @@ struct _GstDspVEncClass {
 
 GType gst_dsp_venc_get_type(void);
 
+void gstdsp_venc_set_frame_info(GstDspBase *base, struct td_buffer *tb,
+		gint type, guint units, gint error);
+gboolean gstdsp_venc_keyframe_pending(GstDspBase *base, struct td_buffer *tb);
+
 G_END_DECLS
 
 #endif /* GST_DSP_VENC_H */
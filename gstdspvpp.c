@@ -10,12 +10,15 @@
 
 #include "gstdspvpp.h"
 #include "gstdspparse.h"
+#include "gstdspbuffer.h"
 #include "plugin.h"
 #include "util.h"
 
 #include "dsp_bridge.h"
 #include "log.h"
 
+#define RGB_BUFFERS 2
+
 static GstDspBaseClass *parent_class;
 
 static inline GstCaps *
@@ -39,6 +42,27 @@ generate_sink_template(void)
 	return caps;
 }
 
+static inline GstCaps *
+generate_rgb_template(void)
+{
+	GstCaps *caps;
+	GstStructure *struc;
+
+	caps = gst_caps_new_empty();
+
+	struc = gst_structure_new("video/x-raw-rgb",
+				  "bpp", G_TYPE_INT, 16, "depth", G_TYPE_INT, 16,
+				  "endianness", G_TYPE_INT, 1234,
+				  "red_mask", G_TYPE_INT, 63488,
+				  "green_mask", G_TYPE_INT, 2016,
+				  "blue_mask", G_TYPE_INT, 31,
+				  NULL);
+
+	gst_caps_append_structure(caps, struc);
+
+	return caps;
+}
+
 static inline GstCaps *
 generate_src_template(void)
 {
@@ -131,6 +155,190 @@ create_node(GstDspBase *base)
 	return node;
 }
 
+static void
+rgb_loop(gpointer data)
+{
+	GstPad *pad = data;
+	GstDspVpp *self = GST_DSP_VPP(GST_OBJECT_PARENT(pad));
+	GstDspBase *base = GST_DSP_BASE(self);
+	struct td_buffer *tb;
+	GstBuffer *buf;
+	GstFlowReturn ret;
+	GSList *events, *l;
+	guint pos;
+	bool pending;
+
+	/* the events might come after the last frame, e.g. eos */
+	g_mutex_lock(self->rgb_ts_mutex);
+	pos = self->rgb_ts_out;
+	while (!self->rgb_flushing && self->rgb_ts_in == pos && !self->rgb_ts[pos].events)
+		g_cond_wait(self->rgb_ts_cond, self->rgb_ts_mutex);
+	if (G_UNLIKELY(self->rgb_flushing)) {
+		g_mutex_unlock(self->rgb_ts_mutex);
+		pr_info(self, "rgb flushing");
+		gst_pad_pause_task(pad);
+		return;
+	}
+	events = self->rgb_ts[pos].events;
+	self->rgb_ts[pos].events = NULL;
+	pending = self->rgb_ts_in != pos;
+	g_mutex_unlock(self->rgb_ts_mutex);
+
+	for (l = events; l; l = l->next) {
+		GstEvent *event = l->data;
+		pr_debug(self, "pushing rgb event: %s", GST_EVENT_TYPE_NAME(event));
+		gst_pad_push_event(pad, event);
+	}
+	g_slist_free(events);
+
+	if (!pending)
+		return;
+
+	tb = async_queue_pop(self->rgb_port->queue);
+	if (G_UNLIKELY(!tb)) {
+		pr_info(self, "no rgb buffer");
+		gst_pad_pause_task(pad);
+		return;
+	}
+
+	if (G_UNLIKELY(!tb->data->len)) {
+		base->send_buffer(base, tb);
+		return;
+	}
+
+	g_mutex_lock(self->rgb_ts_mutex);
+	self->rgb_ts_out = (pos + 1) % ARRAY_SIZE(self->rgb_ts);
+	g_mutex_unlock(self->rgb_ts_mutex);
+
+	/* goes back to the DSP when downstream is done with it */
+	buf = gst_dsp_buffer_new(base, tb);
+	gst_buffer_set_caps(buf, GST_PAD_CAPS(pad));
+	GST_BUFFER_TIMESTAMP(buf) = self->rgb_ts[pos].time;
+	GST_BUFFER_DURATION(buf) = self->rgb_ts[pos].duration;
+
+	/* the main output must not stall because of this one */
+	ret = gst_pad_push(pad, buf);
+	if (G_UNLIKELY(ret != GST_FLOW_OK))
+		pr_debug(self, "rgb pad push failed: %s", gst_flow_get_name(ret));
+}
+
+static void
+setup_rgb_buffers(GstDspVpp *self)
+{
+	GstDspBase *base = GST_DSP_BASE(self);
+	du_port_t *p = self->rgb_port;
+	guint i;
+
+	for (i = 0; i < p->num_buffers; i++) {
+		struct td_buffer *tb = &p->buffers[i];
+
+		tb->comm = dmm_buffer_new(base->dsp_handle, base->proc, DMA_BIDIRECTIONAL);
+		dmm_buffer_allocate(tb->comm, sizeof(*tb->comm));
+		dmm_buffer_map(tb->comm);
+
+		tb->data = dmm_buffer_new(base->dsp_handle, base->proc, p->dir);
+		dmm_buffer_allocate(tb->data, self->rgb_width * self->rgb_height * 2);
+		dmm_buffer_map(tb->data);
+		tb->pinned = tb->clean = true;
+
+		base->send_buffer(base, tb);
+	}
+
+	gst_pad_start_task(self->rgb_pad, rgb_loop, self->rgb_pad);
+}
+
+static void
+free_rgb_buffers(GstDspVpp *self)
+{
+	du_port_t *p = self->rgb_port;
+	guint i;
+
+	if (self->rgb_pad)
+		gst_pad_stop_task(self->rgb_pad);
+
+	for (i = 0; i < p->num_buffers; i++) {
+		struct td_buffer *tb = &p->buffers[i];
+
+		dmm_buffer_free(tb->data);
+		dmm_buffer_free(tb->comm);
+		dmm_buffer_free(tb->params);
+	}
+	du_port_alloc_buffers(p, 0);
+	async_queue_flush(p->queue);
+}
+
+static bool
+send_play_message(GstDspBase *base)
+{
+	GstDspVpp *self = GST_DSP_VPP(base);
+
+	if (!dsp_send_message(base->dsp_handle, base->node, 0x0100, 0, 0))
+		return false;
+
+	if (self->rgb_port->num_buffers)
+		setup_rgb_buffers(self);
+
+	return true;
+}
+
+static void
+got_message(GstDspBase *base,
+	    struct dsp_msg *msg)
+{
+	GstDspVpp *self = GST_DSP_VPP(base);
+	du_port_t *p = self->rgb_port;
+
+	if ((msg->cmd & 0xffffff00) == 0x0600 && (msg->cmd & 0x000000ff) == (uint32_t) p->id) {
+		gstdsp_port_got_buffer(base, p, msg);
+		return;
+	}
+
+	self->base_got_message(base, msg);
+}
+
+static void
+pre_process_buffer(GstDspBase *base,
+		   GstBuffer *buf)
+{
+	GstDspVpp *self = GST_DSP_VPP(base);
+	guint pos;
+
+	if (!self->rgb_port->num_buffers)
+		return;
+
+	g_mutex_lock(self->rgb_ts_mutex);
+	pos = self->rgb_ts_in;
+	self->rgb_ts[pos].time = GST_BUFFER_TIMESTAMP(buf);
+	self->rgb_ts[pos].duration = GST_BUFFER_DURATION(buf);
+	self->rgb_ts_in = (pos + 1) % ARRAY_SIZE(self->rgb_ts);
+	g_mutex_unlock(self->rgb_ts_mutex);
+}
+
+static void
+rgb_ts_clear(GstDspVpp *self)
+{
+	guint i;
+
+	g_mutex_lock(self->rgb_ts_mutex);
+	for (i = 0; i < ARRAY_SIZE(self->rgb_ts); i++) {
+		GSList **events = &self->rgb_ts[i].events;
+		g_slist_foreach(*events, (GFunc) gst_event_unref, NULL);
+		g_slist_free(*events);
+		*events = NULL;
+	}
+	self->rgb_ts_in = self->rgb_ts_out = 0;
+	g_mutex_unlock(self->rgb_ts_mutex);
+}
+
+static void
+reset(GstDspBase *base)
+{
+	GstDspVpp *self = GST_DSP_VPP(base);
+
+	free_rgb_buffers(self);
+	rgb_ts_clear(self);
+}
+
 static inline bool
 destroy_node(GstDspVpp *self,
 	     int dsp_handle,
@@ -199,6 +407,48 @@ configure_caps(GstDspVpp *self,
 	gst_caps_append_structure(out, out_struc);
 }
 
+static inline bool
+configure_rgb_caps(GstDspVpp *self,
+		   GstCaps *in)
+{
+	GstStructure *out_struc;
+	GstCaps *allowed_caps, *out;
+	const GValue *framerate;
+
+	self->rgb_width = self->width;
+	self->rgb_height = self->height;
+
+	allowed_caps = gst_pad_get_allowed_caps(self->rgb_pad);
+	if (allowed_caps) {
+		if (gst_caps_get_size(allowed_caps) > 0) {
+			GstStructure *s;
+			s = gst_caps_get_structure(allowed_caps, 0);
+			gst_structure_get_int(s, "width", &self->rgb_width);
+			gst_structure_get_int(s, "height", &self->rgb_height);
+		}
+		gst_caps_unref(allowed_caps);
+	}
+
+	out_struc = gst_structure_new("video/x-raw-rgb",
+				      "bpp", G_TYPE_INT, 16, "depth", G_TYPE_INT, 16,
+				      "endianness", G_TYPE_INT, 1234,
+				      "red_mask", G_TYPE_INT, 63488,
+				      "green_mask", G_TYPE_INT, 2016,
+				      "blue_mask", G_TYPE_INT, 31,
+				      "width", G_TYPE_INT, self->rgb_width,
+				      "height", G_TYPE_INT, self->rgb_height,
+				      NULL);
+
+	framerate = gst_structure_get_value(gst_caps_get_structure(in, 0), "framerate");
+	if (framerate)
+		gst_structure_set_value(out_struc, "framerate", framerate);
+
+	out = gst_caps_new_empty();
+	gst_caps_append_structure(out, out_struc);
+
+	return gst_pad_take_caps(self->rgb_pad, out);
+}
+
 static gboolean
 sink_setcaps(GstPad *pad,
 	     GstCaps *caps)
@@ -226,6 +476,12 @@ sink_setcaps(GstPad *pad,
 	configure_caps(self, caps, out_caps);
 	base->tmp_caps = out_caps;
 
+	if (self->rgb_pad) {
+		if (!configure_rgb_caps(self, caps))
+			return FALSE;
+		du_port_alloc_buffers(self->rgb_port, RGB_BUFFERS);
+	}
+
 	ret = gst_pad_set_caps(pad, caps);
 
 	if (!ret)
@@ -234,23 +490,147 @@ sink_setcaps(GstPad *pad,
 	return TRUE;
 }
 
+static gboolean
+sink_event(GstDspBase *base,
+	   GstEvent *event)
+{
+	GstDspVpp *self = GST_DSP_VPP(base);
+	GstEventType type = GST_EVENT_TYPE(event);
+	gboolean ret;
+
+	if (!self->rgb_pad)
+		return parent_class->sink_event(base, event);
+
+	/* the rest go in order with the rgb frames, from rgb_loop() */
+	if (!GST_EVENT_IS_SERIALIZED(event) || type == GST_EVENT_FLUSH_STOP) {
+		gst_pad_push_event(self->rgb_pad, gst_event_ref(event));
+	} else {
+		g_mutex_lock(self->rgb_ts_mutex);
+		self->rgb_ts[self->rgb_ts_in].events =
+			g_slist_append(self->rgb_ts[self->rgb_ts_in].events, gst_event_ref(event));
+		g_cond_signal(self->rgb_ts_cond);
+		g_mutex_unlock(self->rgb_ts_mutex);
+	}
+
+	ret = parent_class->sink_event(base, event);
+
+	if (type == GST_EVENT_FLUSH_STOP) {
+		rgb_ts_clear(self);
+		gst_pad_start_task(self->rgb_pad, rgb_loop, self->rgb_pad);
+	}
+
+	return ret;
+}
+
+/* the rgb output can only be added or removed when stopped */
+static GstPad *
+request_new_pad(GstElement *element,
+		GstPadTemplate *templ,
+		const gchar *name)
+{
+	GstDspVpp *self = GST_DSP_VPP(element);
+	GstDspBase *base = GST_DSP_BASE(element);
+	GstPad *pad;
+
+	if (self->rgb_pad) {
+		pr_err(self, "rgb pad already requested");
+		return NULL;
+	}
+
+	if (base->node) {
+		pr_err(self, "can't add rgb pad while running");
+		return NULL;
+	}
+
+	pad = gst_pad_new_from_template(templ, "rgb");
+	gst_pad_use_fixed_caps(pad);
+	if (GST_STATE(element) > GST_STATE_READY)
+		gst_pad_set_active(pad, TRUE);
+	gst_element_add_pad(element, pad);
+
+	self->rgb_pad = pad;
+
+	return pad;
+}
+
+static void
+unlock(GstDspBase *base,
+       gboolean unlock)
+{
+	GstDspVpp *self = GST_DSP_VPP(base);
+
+	g_mutex_lock(self->rgb_ts_mutex);
+	self->rgb_flushing = unlock;
+	g_cond_signal(self->rgb_ts_cond);
+	g_mutex_unlock(self->rgb_ts_mutex);
+
+	if (unlock)
+		async_queue_disable(self->rgb_port->queue);
+	else
+		async_queue_enable(self->rgb_port->queue);
+}
+
+static void
+release_pad(GstElement *element,
+	    GstPad *pad)
+{
+	GstDspVpp *self = GST_DSP_VPP(element);
+	GstDspBase *base = GST_DSP_BASE(element);
+
+	if (pad != self->rgb_pad)
+		return;
+
+	if (base->node)
+		pr_warning(self, "rgb pad released while running");
+
+	unlock(base, TRUE);
+	gst_pad_stop_task(pad);
+	unlock(base, FALSE);
+
+	self->rgb_pad = NULL;
+	gst_element_remove_pad(element, pad);
+}
+
 static void
 instance_init(GTypeInstance *instance,
 	      gpointer g_class)
 {
 	GstDspBase *base;
+	GstDspVpp *self;
 
 	base = GST_DSP_BASE(instance);
+	self = GST_DSP_VPP(instance);
 
 	base->use_pad_alloc = TRUE;
 	base->create_node = create_node;
+	base->send_play_message = send_play_message;
+	base->pre_process_buffer = pre_process_buffer;
+	base->reset = reset;
+	base->unlock = unlock;
+	self->base_got_message = base->got_message;
+	base->got_message = got_message;
 
 	/* ugly, but needed */
 	base->ports[1]->id = 3;
 
+	self->rgb_port = du_port_new(2, DMA_FROM_DEVICE);
+	self->rgb_ts_mutex = g_mutex_new();
+	self->rgb_ts_cond = g_cond_new();
+
 	gst_pad_set_setcaps_function(base->sinkpad, sink_setcaps);
 }
 
+static void
+finalize(GObject *obj)
+{
+	GstDspVpp *self = GST_DSP_VPP(obj);
+
+	du_port_free(self->rgb_port);
+	g_mutex_free(self->rgb_ts_mutex);
+	g_cond_free(self->rgb_ts_cond);
+	G_OBJECT_CLASS(parent_class)->finalize(obj);
+}
+
 static void
 base_init(gpointer g_class)
 {
@@ -272,6 +652,14 @@ base_init(gpointer g_class)
 	gst_element_class_add_pad_template(element_class, template);
 	gst_object_unref(template);
 
+	/* scaled copy of the input, e.g. for a preview */
+	template = gst_pad_template_new("rgb", GST_PAD_SRC,
+					GST_PAD_REQUEST,
+					generate_rgb_template());
+
+	gst_element_class_add_pad_template(element_class, template);
+	gst_object_unref(template);
+
 	template = gst_pad_template_new("sink", GST_PAD_SINK,
 					GST_PAD_ALWAYS,
 					generate_sink_template());
@@ -284,7 +672,19 @@ static void
 class_init(gpointer g_class,
 	   gpointer class_data)
 {
+	GObjectClass *gobject_class;
+	GstElementClass *element_class;
+	GstDspBaseClass *base_class;
+
 	parent_class = g_type_class_peek_parent(g_class);
+	gobject_class = G_OBJECT_CLASS(g_class);
+	element_class = GST_ELEMENT_CLASS(g_class);
+	base_class = GST_DSP_BASE_CLASS(g_class);
+
+	gobject_class->finalize = finalize;
+	element_class->request_new_pad = request_new_pad;
+	element_class->release_pad = release_pad;
+	base_class->sink_event = sink_event;
 }
 
 GType
@@ -18,6 +18,8 @@ G_BEGIN_DECLS
 #define GST_DSP_VPP(obj) (GstDspVpp *)(obj)
 #define GST_DSP_VPP_TYPE (gst_dsp_vpp_get_type())
 #define GST_DSP_VPP_CLASS(obj) (GstDspVppClass *)(obj)
+#define GST_IS_DSP_VPP(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), gst_dsp_vpp_get_type()))
 
 typedef struct _GstDspVpp GstDspVpp;
 typedef struct _GstDspVppClass GstDspVppClass;
@@ -28,6 +30,21 @@ struct _GstDspVpp {
 	GstDspBase element;
 	int width, height;
 	int out_width, out_height;
+
+	/* optional rgb output */
+	GstPad *rgb_pad;
+	du_port_t *rgb_port;
+	int rgb_width, rgb_height;
+	struct {
+		GstClockTime time;
+		GstClockTime duration;
+		GSList *events; /* to go out before this frame */
+	} rgb_ts[8];
+	guint rgb_ts_in, rgb_ts_out;
+	GMutex *rgb_ts_mutex;
+	GCond *rgb_ts_cond;
+	gboolean rgb_flushing;
+	void (*base_got_message)(GstDspBase *base, struct dsp_msg *msg);
 };
 
 struct _GstDspVppClass {
@@ -0,0 +1,489 @@
+/*
+ * Copyright (C) 2010 Felipe Contreras
+ *
+ * Author: Felipe Contreras <felipe.contreras@gmail.com>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+/*
+ * Runs the stream parsers over every access unit of a directory of
+ * elementary-stream samples, without any pipeline in between.
+ *
+ * The manifest has one line per sample:
+ *
+ *   <file> <h263|mpeg4|h264|jpeg> <fs=WxH> [cfs=WxH]
+ *
+ * Every access unit the parser accepts must give the expected sizes, not
+ * only the last one.
+ *
+ * Without a manifest every file with a known extension is parsed, and the
+ * results are only reported.
+ */
+
+#include <gst/gst.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "gstdspparse.h"
+#include "gstdspvdec.h"
+
+typedef bool (*parse_func)(GstDspBase *base, GstBuffer *buf);
+
+/* the binary is linked with --wrap for these */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+
+static unsigned long alloc_count;
+
+void *__wrap_malloc(size_t size)
+{
+	alloc_count++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	alloc_count++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	alloc_count++;
+	return __real_realloc(ptr, size);
+}
+
+struct codec {
+	const char *name;
+	parse_func parse;
+	const char *exts[4];
+};
+
+static const struct codec codecs[] = {
+	{ "h263", gst_dsp_h263_parse, { ".263", ".h263", NULL } },
+	{ "mpeg4", gst_dsp_mpeg4_parse, { ".m4v", ".mpeg4", ".cmp", NULL } },
+	{ "h264", gst_dsp_h264_parse, { ".264", ".h264", ".avc", NULL } },
+	{ "jpeg", gst_dsp_jpeg_parse, { ".jpg", ".jpeg", NULL } },
+};
+
+struct sample {
+	char *filename;
+	const struct codec *codec;
+	char *expected;
+	char *expected_crop;
+};
+
+struct au {
+	unsigned offset;
+	unsigned size;
+};
+
+static GstDspBase *dec;
+static unsigned iterations = 10;
+
+static const struct codec *find_codec(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < G_N_ELEMENTS(codecs); i++)
+		if (strcmp(codecs[i].name, name) == 0)
+			return &codecs[i];
+
+	return NULL;
+}
+
+static const struct codec *guess_codec(const char *filename)
+{
+	unsigned i, j;
+
+	for (i = 0; i < G_N_ELEMENTS(codecs); i++)
+		for (j = 0; codecs[i].exts[j]; j++)
+			if (g_str_has_suffix(filename, codecs[i].exts[j]))
+				return &codecs[i];
+
+	return NULL;
+}
+
+/* is this start code the beginning of a new access unit? */
+static bool new_au(const struct codec *codec, const uint8_t *p, unsigned left, bool *in_pic)
+{
+	bool r = false;
+
+	if (codec->parse == gst_dsp_h263_parse) {
+		/* every picture start code */
+		return (p[2] & 0xfc) == 0x80;
+	}
+
+	if (p[2] != 0x01 || left < 4)
+		return false;
+
+	if (codec->parse == gst_dsp_mpeg4_parse) {
+		unsigned code = p[3];
+
+		if (code == 0xb6) {
+			r = *in_pic;
+			*in_pic = true;
+		} else if (code == 0xb0 || code == 0xb3 || code <= 0x2f) {
+			r = *in_pic;
+			*in_pic = false;
+		}
+	} else {
+		unsigned type = p[3] & 0x1f;
+
+		if (type == 1 || type == 5) {
+			/* first_mb_in_slice == 0 */
+			r = *in_pic && left > 4 && (p[4] & 0x80);
+			*in_pic = true;
+		} else if (type == 6 || type == 7 || type == 8 || type == 9) {
+			r = *in_pic;
+			*in_pic = false;
+		}
+	}
+
+	return r;
+}
+
+static unsigned split_aus(const struct codec *codec,
+		const uint8_t *data, unsigned size,
+		struct au **ret)
+{
+	struct au *aus = NULL;
+	unsigned nr = 0, alloc = 0;
+	unsigned i, start = 0;
+	bool in_pic = false;
+
+	/* one image per file */
+	if (codec->parse == gst_dsp_jpeg_parse)
+		goto last;
+
+	for (i = 0; i + 3 <= size; i++) {
+		if (data[i] || data[i + 1])
+			continue;
+		if (!new_au(codec, data + i, size - i, &in_pic))
+			continue;
+		if (i > start) {
+			if (nr == alloc) {
+				alloc = alloc ? alloc * 2 : 64;
+				aus = g_renew(struct au, aus, alloc);
+			}
+			aus[nr].offset = start;
+			aus[nr].size = i - start;
+			nr++;
+		}
+		start = i;
+	}
+
+last:
+	if (size > start) {
+		aus = g_renew(struct au, aus, nr + 1);
+		aus[nr].offset = start;
+		aus[nr].size = size - start;
+		nr++;
+	}
+
+	*ret = aus;
+	return nr;
+}
+
+static void reset_dec(void)
+{
+	GstDspVDec *vdec = GST_DSP_VDEC(dec);
+
+	dec->parsed = false;
+	vdec->width = vdec->height = 0;
+	vdec->crop_width = vdec->crop_height = 0;
+}
+
+static void format_result(char *result, char *result_crop)
+{
+	GstDspVDec *vdec = GST_DSP_VDEC(dec);
+
+	snprintf(result, 32, "fs=%ix%i",
+			vdec->width, vdec->height);
+	snprintf(result_crop, 32, "cfs=%ix%i",
+			vdec->crop_width, vdec->crop_height);
+}
+
+static bool check_result(struct sample *sample,
+		const char *result, const char *result_crop)
+{
+	if (strcmp(sample->expected, result) != 0)
+		return false;
+	if (sample->expected_crop && strcmp(sample->expected_crop, result_crop) != 0)
+		return false;
+	return true;
+}
+
+/*
+ * Untimed pass, checking the sizes after every access unit the parser
+ * accepts. Returns the number of mismatching ones.
+ */
+static unsigned check_aus(struct sample *sample, const gchar *contents,
+		struct au *aus, unsigned nr_aus, GstBuffer *buf,
+		unsigned *parsed)
+{
+	char result[32], result_crop[32];
+	unsigned i, bad = 0;
+
+	reset_dec();
+	*parsed = 0;
+	for (i = 0; i < nr_aus; i++) {
+		GST_BUFFER_DATA(buf) = (guint8 *) contents + aus[i].offset;
+		GST_BUFFER_SIZE(buf) = aus[i].size;
+		if (!sample->codec->parse(dec, buf))
+			continue;
+		(*parsed)++;
+		format_result(result, result_crop);
+		if (check_result(sample, result, result_crop))
+			continue;
+		if (!bad)
+			g_printerr("%s: au %u at offset %u: %s %s\n",
+					sample->filename, i, aus[i].offset,
+					result, result_crop);
+		bad++;
+	}
+
+	return bad;
+}
+
+static bool run_sample(const char *dir, struct sample *sample)
+{
+	gchar *path;
+	gchar *contents;
+	gsize size;
+	GError *err = NULL;
+	struct au *aus;
+	unsigned nr_aus, i, it;
+	unsigned parsed = 0, bad = 0;
+	unsigned long allocs;
+	GstBuffer *buf;
+	GTimer *timer;
+	gdouble elapsed;
+	char result[32], result_crop[32];
+	const char *status = "-";
+	bool ok = true;
+
+	path = g_build_filename(dir, sample->filename, NULL);
+	if (!g_file_get_contents(path, &contents, &size, &err)) {
+		g_printerr("%s: %s\n", sample->filename, err->message);
+		g_error_free(err);
+		g_free(path);
+		return false;
+	}
+	g_free(path);
+
+	nr_aus = split_aus(sample->codec, (uint8_t *) contents, size, &aus);
+
+	/* the data is owned by contents, never by the buffer */
+	buf = gst_buffer_new();
+
+	if (sample->expected) {
+		bad = check_aus(sample, contents, aus, nr_aus, buf, &parsed);
+		ok = parsed && !bad;
+	}
+
+	timer = g_timer_new();
+	allocs = alloc_count;
+
+	for (it = 0; it < iterations; it++) {
+		reset_dec();
+		parsed = 0;
+		for (i = 0; i < nr_aus; i++) {
+			GST_BUFFER_DATA(buf) = (guint8 *) contents + aus[i].offset;
+			GST_BUFFER_SIZE(buf) = aus[i].size;
+			if (sample->codec->parse(dec, buf))
+				parsed++;
+		}
+	}
+
+	elapsed = g_timer_elapsed(timer, NULL);
+	allocs = alloc_count - allocs;
+	g_timer_destroy(timer);
+
+	GST_BUFFER_DATA(buf) = NULL;
+	GST_BUFFER_SIZE(buf) = 0;
+	gst_buffer_unref(buf);
+
+	format_result(result, result_crop);
+
+	if (sample->expected) {
+		ok = ok && check_result(sample, result, result_crop);
+		status = ok ? "pass" : "FAIL";
+	}
+
+	g_print("%s codec=%s aus=%u parsed=%u bad=%u parses/s=%.0f allocs/parse=%.2f %s %s %s\n",
+			sample->filename, sample->codec->name,
+			nr_aus, parsed, bad,
+			elapsed > 0 ? nr_aus * iterations / elapsed : 0,
+			nr_aus ? (double) allocs / (nr_aus * iterations) : 0,
+			result, result_crop, status);
+
+	g_free(aus);
+	g_free(contents);
+
+	return ok;
+}
+
+static GSList *read_manifest(const char *filename)
+{
+	GSList *samples = NULL;
+	gchar *contents;
+	gchar **lines, **l;
+	GError *err = NULL;
+
+	if (!g_file_get_contents(filename, &contents, NULL, &err)) {
+		g_printerr("%s: %s\n", filename, err->message);
+		g_error_free(err);
+		return NULL;
+	}
+
+	lines = g_strsplit(contents, "\n", -1);
+	g_free(contents);
+
+	for (l = lines; *l; l++) {
+		gchar **tokens;
+		struct sample *sample;
+		const struct codec *codec;
+
+		g_strstrip(*l);
+		if (**l == '\0' || **l == '#')
+			continue;
+
+		tokens = g_strsplit_set(*l, " \t", -1);
+		if (g_strv_length(tokens) < 3) {
+			g_printerr("bad manifest line: %s\n", *l);
+			g_strfreev(tokens);
+			continue;
+		}
+
+		codec = find_codec(tokens[1]);
+		if (!codec) {
+			g_printerr("unknown codec: %s\n", tokens[1]);
+			g_strfreev(tokens);
+			continue;
+		}
+
+		sample = g_new0(struct sample, 1);
+		sample->filename = g_strdup(tokens[0]);
+		sample->codec = codec;
+		sample->expected = g_strdup(tokens[2]);
+		sample->expected_crop = g_strdup(tokens[3]);
+		samples = g_slist_prepend(samples, sample);
+
+		g_strfreev(tokens);
+	}
+
+	g_strfreev(lines);
+
+	return g_slist_reverse(samples);
+}
+
+static gint sample_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct sample *sa = a, *sb = b;
+	return strcmp(sa->filename, sb->filename);
+}
+
+static GSList *read_dir(const char *dirname)
+{
+	GSList *samples = NULL;
+	GDir *dir;
+	const gchar *name;
+	GError *err = NULL;
+
+	dir = g_dir_open(dirname, 0, &err);
+	if (!dir) {
+		g_printerr("%s: %s\n", dirname, err->message);
+		g_error_free(err);
+		return NULL;
+	}
+
+	while ((name = g_dir_read_name(dir))) {
+		struct sample *sample;
+		const struct codec *codec;
+
+		codec = guess_codec(name);
+		if (!codec)
+			continue;
+
+		sample = g_new0(struct sample, 1);
+		sample->filename = g_strdup(name);
+		sample->codec = codec;
+		samples = g_slist_prepend(samples, sample);
+	}
+
+	g_dir_close(dir);
+
+	return g_slist_sort(samples, sample_cmp);
+}
+
+static void free_sample(gpointer data, gpointer user_data)
+{
+	struct sample *sample = data;
+
+	g_free(sample->filename);
+	g_free(sample->expected);
+	g_free(sample->expected_crop);
+	g_free(sample);
+}
+
+GstDebugCategory *gstdsp_debug;
+
+int main(int argc, char *argv[])
+{
+	GSList *samples, *l;
+	unsigned failed = 0, total = 0;
+
+	gst_init(&argc, &argv);
+
+	if (argc < 2) {
+		g_printerr("usage: %s <dir> [manifest] [iterations]\n", argv[0]);
+		return -1;
+	}
+
+	if (argc >= 4)
+		iterations = MAX(atoi(argv[3]), 1);
+
+#ifndef GST_DISABLE_GST_DEBUG
+	gstdsp_debug = _gst_debug_category_new("dsp", 0, "DSP stuff");
+#endif
+
+	dec = g_object_new(GST_DSP_VDEC_TYPE, NULL);
+
+	if (argc >= 3) {
+		/* a typo shouldn't look like a pass */
+		samples = read_manifest(argv[2]);
+		if (!samples) {
+			g_printerr("no samples in manifest: %s\n", argv[2]);
+			g_object_unref(dec);
+			return 1;
+		}
+	} else
+		samples = read_dir(argv[1]);
+
+	for (l = samples; l; l = l->next) {
+		total++;
+		if (!run_sample(argv[1], l->data))
+			failed++;
+	}
+
+	g_print("samples=%u failed=%u\n", total, failed);
+
+	g_slist_foreach(samples, free_sample, NULL);
+	g_slist_free(samples);
+
+	g_object_unref(dec);
+
+	return failed ? 1 : 0;
+}
@@ -146,6 +146,10 @@ static inline void update_caps(GstDspBase *base, struct dsp_node *node)
 	caps = gst_pad_get_negotiated_caps(base->srcpad);
 	caps = gst_caps_make_writable(caps);
 	gst_caps_set_simple(caps, "rate", G_TYPE_INT, self->samplerate, NULL);
+	/* parametric stereo turns mono into stereo */
+	if (self->channels == 1)
+		gst_caps_set_simple(caps, "channels", G_TYPE_INT,
+				    self->parametric_stereo ? 2 : 1, NULL);
 	gst_pad_take_caps(base->srcpad, caps);
 }
 
@@ -13,6 +13,10 @@
 
 #include "td_h264dec_common.h"
 #include "gstdspparse.h"
+#include "dmm_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
 
 void td_h264dec_check_stream_params(GstDspBase *self, GstBuffer *buf)
 {
@@ -128,3 +132,79 @@ fail:
 	pr_warning(self, "failed to transform h264 to codec format");
 	return NULL;
 }
+
+void td_h264dec_transform_nal_encoding(GstDspVDec *self, struct td_buffer *tb)
+{
+	guint8 *data;
+	gint size;
+	gint lol;
+	guint val, nal;
+	dmm_buffer_t *b = tb->data;
+
+	data = b->data;
+	size = b->len;
+	lol = self->priv.h264.lol;
+
+	nal = 0;
+	while (size) {
+		if (size < lol)
+			goto fail;
+
+		/* get NAL size encoded in BE lol bytes */
+		val = GST_READ_UINT32_BE(data);
+		val >>= ((4 - lol) << 3);
+		if (lol == 4)
+			/* blank size prefix with 00 00 00 01 */
+			GST_WRITE_UINT32_BE(data, 0x01);
+		else if (lol == 3)
+			/* blank size prefix with 00 00 01 */
+			GST_WRITE_UINT24_BE(data, 0x01);
+		else
+			nal++;
+		data += lol + val;
+		size -= lol + val;
+	}
+
+	if (lol < 3) {
+		/* slower, but unlikely path; need to copy stuff to make room for sync */
+		guint8 *odata, *alloc_data;
+		gint osize;
+
+		/* set up for next run */
+		data = b->data;
+		size = b->len;
+		osize = size + nal * (4 - lol);
+		/* save this so it is not free'd by subsequent allocate */
+		alloc_data = b->allocated_data;
+		b->allocated_data = NULL;
+		dmm_buffer_allocate(b, osize);
+
+		odata = b->data;
+		while (size) {
+			if (size < lol)
+				goto fail;
+
+			/* get NAL size encoded in BE lol bytes */
+			val = GST_READ_UINT32_BE(data);
+			val >>= ((4 - lol) << 3);
+			GST_WRITE_UINT32_BE(odata, 0x01);
+			odata += 4;
+			data += lol;
+			memcpy(odata, data, val);
+			odata += val;
+			data += val;
+			size -= lol + val;
+		}
+		/* now release original data */
+		if (tb->user_data) {
+			gst_buffer_unref(tb->user_data);
+			tb->user_data = NULL;
+		}
+		free(alloc_data);
+	}
+	return;
+
+fail:
+	pr_warning(self, "failed to transform h264 to codec format");
+	return;
+}
@@ -18,5 +18,6 @@
 
 void td_h264dec_check_stream_params(GstDspBase *self, GstBuffer *buf);
 GstBuffer *td_h264dec_transform_extra_data(GstDspVDec *vdec, GstBuffer *buf);
+void td_h264dec_transform_nal_encoding(GstDspVDec *self, struct td_buffer *tb);
 
 #endif
@@ -16,6 +16,7 @@
 
 #include "gstdspbase.h"
 #include "gstdspvenc.h"
+#include "td_h264enc_common.h"
 
 struct create_args {
 	uint32_t size;
@@ -195,89 +196,14 @@ static void in_send_cb(GstDspBase *base, struct td_buffer *tb)
 	param = tb->params->data;
 	param->frame_index = g_atomic_int_exchange_and_add(&self->frame_index, 1);
 	param->bitrate = g_atomic_int_get(&self->bitrate);
-	g_mutex_lock(self->keyframe_mutex);
-	param->force_i_frame = self->keyframe_event ? 1 : 0;
-	if (self->keyframe_event) {
-		gst_pad_push_event(base->srcpad, self->keyframe_event);
-		self->keyframe_event = NULL;
-	}
-	g_mutex_unlock(self->keyframe_mutex);
-}
-
-static void create_codec_data(GstDspBase *base)
-{
-	GstDspVEnc *self = GST_DSP_VENC(base);
-	guint8 *sps, *pps, *codec_data;
-	guint16 sps_size, pps_size, offset;
-
-	sps = GST_BUFFER_DATA(self->priv.h264.sps);
-	pps = GST_BUFFER_DATA(self->priv.h264.pps);
-
-	sps_size = GST_BUFFER_SIZE(self->priv.h264.sps);
-	pps_size = GST_BUFFER_SIZE(self->priv.h264.pps);
-
-	offset = 0;
-
-	self->priv.h264.codec_data = gst_buffer_new_and_alloc(sps_size + pps_size + 11);
-	codec_data = GST_BUFFER_DATA(self->priv.h264.codec_data);
-
-	codec_data[offset++] = 0x01;
-	codec_data[offset++] = sps[1]; /* AVCProfileIndication*/
-	codec_data[offset++] = sps[2]; /* profile_compatibility*/
-	codec_data[offset++] = sps[3]; /* AVCLevelIndication */
-	codec_data[offset++] = 0xff;
-	codec_data[offset++] = 0xe1;
-	codec_data[offset++] = (sps_size >> 8) & 0xff;
-	codec_data[offset++] = sps_size & 0xff;
-
-	memcpy(codec_data + offset, sps, sps_size);
-	offset += sps_size;
-
-	codec_data[offset++] = 0x1;
-	codec_data[offset++] = (pps_size >> 8) & 0xff;
-	codec_data[offset++] = pps_size & 0xff;
-
-	memcpy(codec_data + offset, pps, pps_size);
-}
-
-static void strip_sps_pps_header(GstDspBase *base,
-		dmm_buffer_t *b,
-		struct out_params *param)
-{
-	GstDspVEnc *self = GST_DSP_VENC(base);
-	char *data = b->data;
-	unsigned i;
-
-	if (OUT_PARAMS_VER(base,param,nalus_per_frame) <= 1)
-		return;
-
-	if (!self->priv.h264.sps_received) {
-		self->priv.h264.sps_received = TRUE;
-		return;
-	}
-
-	for (i = 0; i < OUT_PARAMS_VER(base,param,nalus_per_frame); i++) {
-		if ((data[4] & 0x1f) == 7 || (data[4] & 0x1f) == 8) {
-			data += OUT_PARAMS_VER(base,param,nalu_sizes[i]);
-			b->data = data;
-			b->len -= OUT_PARAMS_VER(base,param,nalu_sizes[i]);
-		}
-	}
-}
-
-static void ignore_sps_pps_header(GstDspBase *base, dmm_buffer_t *b)
-{
-	char *data = b->data;
-
-	if ((data[4] & 0x1f) == 7 || (data[4] & 0x1f) == 8)
-		base->skip_hack_2++;
+	param->force_i_frame = gstdsp_venc_keyframe_pending(base, tb);
 }
 
 static void out_recv_cb(GstDspBase *base, struct td_buffer *tb)
 {
-	GstDspVEnc *self = GST_DSP_VENC(base);
 	dmm_buffer_t *b = tb->data;
 	struct out_params *param;
+	unsigned nalus;
 	param = tb->params->data;
 
 	pr_debug(base, "frame type: %d", OUT_PARAMS_VER(base, param,frame_type));
@@ -286,40 +212,17 @@ static void out_recv_cb(GstDspBase *base, struct td_buffer *tb)
 	if (b->len == 0)
 		return;
 
-	if (self->priv.h264.bytestream) {
-		strip_sps_pps_header(base, b, param);
-		return;
-	}
+	nalus = OUT_PARAMS_VER(base, param, nalus_per_frame);
+	if (base->sn_api)
+		nalus = MIN(nalus, G_N_ELEMENTS(param->ver.v1.nalu_sizes));
+	else
+		nalus = MIN(nalus, G_N_ELEMENTS(param->ver.v0.nalu_sizes));
 
-	if (G_LIKELY(self->priv.h264.codec_data_done)) {
-		/* prefix the NALU with a lenght field, not counting the start code */
-		*(uint32_t*)b->data = GINT_TO_BE(b->len - 4);
-		ignore_sps_pps_header(base, b);
-	}
-	else {
-		if (!self->priv.h264.sps_received) {
-			/* skip the start code 0x00000001 when storing SPS */
-			self->priv.h264.sps = gst_buffer_new_and_alloc(b->len - 4);
-			memcpy(GST_BUFFER_DATA(self->priv.h264.sps), b->data + 4, b->len - 4);
-			self->priv.h264.sps_received = TRUE;
-		} else if (!self->priv.h264.pps_received) {
-			/* skip the start code 0x00000001 when storing PPS */
-			self->priv.h264.pps = gst_buffer_new_and_alloc(b->len - 4);
-			memcpy(GST_BUFFER_DATA(self->priv.h264.pps), b->data + 4, b->len - 4);
-			self->priv.h264.pps_received = TRUE;
-		}
-
-		if (self->priv.h264.pps_received && self->priv.h264.sps_received) {
-			create_codec_data(base);
-			if (gstdsp_set_codec_data_caps(base, self->priv.h264.codec_data)) {
-				self->priv.h264.codec_data_done = TRUE;
-				gst_buffer_replace(&self->priv.h264.sps, NULL);
-				gst_buffer_replace(&self->priv.h264.pps, NULL);
-				gst_buffer_replace(&self->priv.h264.codec_data, NULL);
-			}
-		}
-		base->skip_hack_2++;
-	}
+	td_h264enc_process_output(base, b,
+			&OUT_PARAMS_VER(base, param, nalu_sizes[0]), nalus);
+
+	gstdsp_venc_set_frame_info(base, tb, OUT_PARAMS_VER(base, param, frame_type),
+			nalus, base->sn_api ? param->ver.v1.error_code : 0);
 }
 
 static void setup_in_params(GstDspBase *base, dmm_buffer_t *tmp)
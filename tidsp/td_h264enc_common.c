@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2009-2010 Felipe Contreras
+ * Copyright (C) 2009-2010 Nokia Corporation
+ *
+ * Author: Felipe Contreras <felipe.contreras@gmail.com>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#include "td_h264enc_common.h"
+#include "dmm_buffer.h"
+
+#include <string.h>
+
+/* room for a few sets of SPS and PPS */
+#define AVCC_MAX_SIZE 1024
+
+static unsigned start_code_len(const guint8 *nal, unsigned size)
+{
+	if (size > 4 && !nal[0] && !nal[1] && !nal[2] && nal[3] == 1)
+		return 4;
+	if (size > 3 && !nal[0] && !nal[1] && nal[2] == 1)
+		return 3;
+	return 0;
+}
+
+/* the sizes reported by the DSP must cover the buffer exactly */
+static bool check_nalu_sizes(dmm_buffer_t *b,
+		const uint32_t *nalu_sizes, unsigned nalus)
+{
+	size_t total = 0;
+	unsigned i;
+
+	if (!nalu_sizes || !nalus)
+		return false;
+
+	for (i = 0; i < nalus; i++) {
+		if (!nalu_sizes[i] || nalu_sizes[i] > b->len - total)
+			return false;
+		total += nalu_sizes[i];
+	}
+
+	return total == b->len;
+}
+
+static bool find_param_set(GstBuffer *codec_data,
+		unsigned start, unsigned end,
+		const guint8 *nal, unsigned size)
+{
+	guint8 *data = GST_BUFFER_DATA(codec_data);
+	unsigned len;
+
+	while (start + 2 <= end) {
+		len = GST_READ_UINT16_BE(data + start);
+		start += 2;
+		if (len == size && memcmp(data + start, nal, size) == 0)
+			return true;
+		start += len;
+	}
+
+	return false;
+}
+
+/*
+ * The avcC is built in place as the parameter sets arrive, so each of them
+ * is copied only once:
+ *
+ *   header (6) | sps entries | nr of pps (1) | pps entries
+ */
+static void add_param_set(GstDspVEnc *self, const guint8 *nal, unsigned size)
+{
+	GstBuffer *codec_data = self->priv.h264.codec_data;
+	unsigned sps_end = self->priv.h264.sps_end;
+	guint8 *data;
+	unsigned end;
+	bool sps = (nal[0] & 0x1f) == 7;
+
+	if (!codec_data) {
+		codec_data = gst_buffer_new_and_alloc(AVCC_MAX_SIZE);
+		data = GST_BUFFER_DATA(codec_data);
+		data[0] = 0x01;
+		data[1] = data[2] = data[3] = 0; /* from the first SPS */
+		data[4] = 0xff; /* 4 bytes NAL length */
+		data[5] = 0xe0; /* no SPS yet */
+		data[6] = 0; /* no PPS yet */
+		GST_BUFFER_SIZE(codec_data) = 7;
+		self->priv.h264.codec_data = codec_data;
+		self->priv.h264.sps_end = sps_end = 6;
+		self->priv.h264.nr_sps = self->priv.h264.nr_pps = 0;
+	}
+
+	data = GST_BUFFER_DATA(codec_data);
+	end = GST_BUFFER_SIZE(codec_data);
+
+	/* headers are repeated on every IDR */
+	if (sps && find_param_set(codec_data, 6, sps_end, nal, size))
+		return;
+	if (!sps && find_param_set(codec_data, sps_end + 1, end, nal, size))
+		return;
+
+	if (size < 4 || end + 2 + size > AVCC_MAX_SIZE ||
+			(sps && self->priv.h264.nr_sps == 31) ||
+			(!sps && self->priv.h264.nr_pps == 255))
+	{
+		pr_warning(self, "can't store %s of %u bytes", sps ? "SPS" : "PPS", size);
+		return;
+	}
+
+	if (sps) {
+		if (self->priv.h264.nr_sps == 0)
+			memcpy(data + 1, nal + 1, 3); /* profile, compat, level */
+		/* make room in front of the PPS section */
+		memmove(data + sps_end + 2 + size, data + sps_end, end - sps_end);
+		GST_WRITE_UINT16_BE(data + sps_end, size);
+		memcpy(data + sps_end + 2, nal, size);
+		self->priv.h264.sps_end += 2 + size;
+		data[5] = 0xe0 | ++self->priv.h264.nr_sps;
+	} else {
+		GST_WRITE_UINT16_BE(data + end, size);
+		memcpy(data + end + 2, nal, size);
+		data[sps_end] = ++self->priv.h264.nr_pps;
+	}
+
+	GST_BUFFER_SIZE(codec_data) = end + 2 + size;
+}
+
+static void set_codec_data(GstDspBase *base)
+{
+	GstDspVEnc *self = GST_DSP_VENC(base);
+
+	pr_debug(self, "codec data with %u SPS, %u PPS",
+			self->priv.h264.nr_sps, self->priv.h264.nr_pps);
+
+	if (gstdsp_set_codec_data_caps(base, self->priv.h264.codec_data)) {
+		self->priv.h264.codec_data_done = TRUE;
+		gst_buffer_replace(&self->priv.h264.codec_data, NULL);
+	}
+}
+
+/*
+ * Goes through the NAL units of an output buffer, as reported by the DSP,
+ * in a single pass: SPS and PPS are gathered into the codec_data, and
+ * dropped from the stream once it's been set. In avc mode every start code
+ * is replaced in place by the length of its NAL unit; a 3-byte one first
+ * gets the rest of the buffer moved up by one.
+ */
+void td_h264enc_process_output(GstDspBase *base, dmm_buffer_t *b,
+		const uint32_t *nalu_sizes, unsigned nalus)
+{
+	GstDspVEnc *self = GST_DSP_VENC(base);
+	guint8 *data = b->data;
+	uint32_t whole = b->len;
+	unsigned i, offset = 0, headers = 0;
+	bool slices = false;
+
+	if (!check_nalu_sizes(b, nalu_sizes, nalus)) {
+		/* treat it as a single unit */
+		nalu_sizes = &whole;
+		nalus = 1;
+	}
+
+	for (i = 0; i < nalus; i++) {
+		guint8 *nal = data + offset;
+		unsigned size = nalu_sizes[i];
+		unsigned sc = start_code_len(nal, size);
+		int type;
+
+		offset += size;
+
+		if (!sc) {
+			pr_warning(self, "missing start code");
+			slices = true;
+			continue;
+		}
+
+		if (!self->priv.h264.bytestream) {
+			if (G_UNLIKELY(sc == 3)) {
+				/* make room for the 4-byte length; this is rare */
+				if (b->len >= b->size) {
+					pr_warning(self, "short start code, no room to prefix");
+					goto drop;
+				}
+				memmove(nal + 1, nal, data + b->len - nal);
+				b->len++;
+				size++;
+				offset++;
+				sc = 4;
+			}
+			GST_WRITE_UINT32_BE(nal, size - 4);
+		}
+
+		type = nal[sc] & 0x1f;
+
+		if (type != 7 && type != 8) {
+			slices = true;
+			continue;
+		}
+
+		if (!self->priv.h264.codec_data_done && !self->priv.h264.bytestream)
+			add_param_set(self, nal + sc, size - sc);
+		if (!slices)
+			headers += size;
+	}
+
+	if (self->priv.h264.bytestream) {
+		/* keep only the first headers */
+		if (!self->priv.h264.codec_data_done) {
+			self->priv.h264.codec_data_done = TRUE;
+			return;
+		}
+		if (slices && headers) {
+			b->data = data + headers;
+			b->len -= headers;
+		}
+		return;
+	}
+
+	if (G_UNLIKELY(!self->priv.h264.codec_data_done)) {
+		/* all the parameter sets come before the first slice */
+		if (!slices)
+			goto drop;
+		if (self->priv.h264.nr_sps && self->priv.h264.nr_pps)
+			set_codec_data(base);
+		else
+			pr_warning(self, "no SPS/PPS before the first slice");
+	}
+
+	if (!slices)
+		goto drop;
+
+	if (headers) {
+		b->data = data + headers;
+		b->len -= headers;
+	}
+	return;
+
+drop:
+	base->skip_hack_2++;
+}
@@ -0,0 +1,20 @@
+/*
+ * Copyright (C) 2009-2010 Felipe Contreras
+ * Copyright (C) 2009-2010 Nokia Corporation
+ *
+ * Author: Felipe Contreras <felipe.contreras@gmail.com>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#ifndef TD_H264ENC_COMMON_H
+#define TD_H264ENC_COMMON_H
+
+#include "gstdspvenc.h"
+
+void td_h264enc_process_output(GstDspBase *base, dmm_buffer_t *b,
+		const uint32_t *nalu_sizes, unsigned nalus);
+
+#endif
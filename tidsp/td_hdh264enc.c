@@ -16,6 +16,7 @@
 
 #include "gstdspbase.h"
 #include "gstdspvenc.h"
+#include "td_h264enc_common.h"
 #include "util.h"
 
 /**
@@ -302,22 +303,12 @@ static void in_send_cb(GstDspBase *base, struct td_buffer *tb)
 	param->start_mb         = 1;
 	param->num_of_mbs       = 0;
 
-	g_mutex_lock(self->keyframe_mutex);
-	param->force_i_frame = self->keyframe_event ? 1 : 0;
-	if (self->keyframe_event) {
-		gst_pad_push_event(base->srcpad, self->keyframe_event);
-		self->keyframe_event = NULL;
-	}
-	g_mutex_unlock(self->keyframe_mutex);
+	param->force_i_frame = gstdsp_venc_keyframe_pending(base, tb);
 	if (self->priv.h264.idr_interval) {
 		GstClockTime timestamp;
-		gint pos;
 
-		g_mutex_lock(base->ts_mutex);
-		pos = base->ts_in_pos ? base->ts_in_pos : ARRAY_SIZE(base->ts_array);
-		pos--;
-		timestamp = base->ts_array[pos].time;
-		g_mutex_unlock(base->ts_mutex);
+		/* written by this thread before sending */
+		timestamp = base->ts_array[tb->data->ts_index].time;
 		if (self->priv.h264.last_idr + (guint) self->priv.h264.idr_interval * GST_SECOND < timestamp) {
 			pr_debug(self, "forcing IDR frame");
 			param->force_i_frame = 1;
@@ -326,50 +317,6 @@ static void in_send_cb(GstDspBase *base, struct td_buffer *tb)
 	}
 }
 
-static void create_codec_data(GstDspBase *base)
-{
-	GstDspVEnc *self = GST_DSP_VENC(base);
-	guint8 *sps, *pps, *codec_data;
-	guint16 sps_size, pps_size, offset;
-
-	sps = GST_BUFFER_DATA(self->priv.h264.sps);
-	pps = GST_BUFFER_DATA(self->priv.h264.pps);
-
-	sps_size = GST_BUFFER_SIZE(self->priv.h264.sps);
-	pps_size = GST_BUFFER_SIZE(self->priv.h264.pps);
-
-	offset = 0;
-
-	self->priv.h264.codec_data = gst_buffer_new_and_alloc(sps_size + pps_size + 11);
-	codec_data = GST_BUFFER_DATA(self->priv.h264.codec_data);
-
-	codec_data[offset++] = 0x01;
-	codec_data[offset++] = sps[1]; /* AVCProfileIndication*/
-	codec_data[offset++] = sps[2]; /* profile_compatibility*/
-	codec_data[offset++] = sps[3]; /* AVCLevelIndication */
-	codec_data[offset++] = 0xff;
-	codec_data[offset++] = 0xe1;
-	codec_data[offset++] = (sps_size >> 8) & 0xff;
-	codec_data[offset++] = sps_size & 0xff;
-
-	memcpy(codec_data + offset, sps, sps_size);
-	offset += sps_size;
-
-	codec_data[offset++] = 0x1;
-	codec_data[offset++] = (pps_size >> 8) & 0xff;
-	codec_data[offset++] = pps_size & 0xff;
-
-	memcpy(codec_data + offset, pps, pps_size);
-}
-
-static void ignore_sps_pps_header(GstDspBase *base, dmm_buffer_t *b)
-{
-	char *data = b->data;
-
-	if ((data[4] & 0x1f) == 7 || (data[4] & 0x1f) == 8)
-		base->skip_hack_2++;
-}
-
 static void out_recv_cb(GstDspBase *base, struct td_buffer *tb)
 {
 	GstDspVEnc *self = GST_DSP_VENC(base);
@@ -394,38 +341,12 @@ static void out_recv_cb(GstDspBase *base, struct td_buffer *tb)
 	if (b->len == 0)
 		return;
 
-	if (self->priv.h264.bytestream)
-		return;
+	if (!self->priv.h264.bytestream)
+		td_h264enc_process_output(base, b, param->nalu_sizes,
+				MIN(param->nalus_per_frame, G_N_ELEMENTS(param->nalu_sizes)));
 
-	if (G_LIKELY(self->priv.h264.codec_data_done)) {
-		/* prefix the NALU with a lenght field, not counting the start code */
-		*(uint32_t *)b->data = GINT_TO_BE(b->len - 4);
-		ignore_sps_pps_header(base, b);
-	}
-	else {
-		if (!self->priv.h264.sps_received) {
-			/* skip the start code 0x00000001 when storing SPS */
-			self->priv.h264.sps = gst_buffer_new_and_alloc(b->len - 4);
-			memcpy(GST_BUFFER_DATA(self->priv.h264.sps), b->data + 4, b->len - 4);
-			self->priv.h264.sps_received = TRUE;
-		} else if (!self->priv.h264.pps_received) {
-			/* skip the start code 0x00000001 when storing PPS */
-			self->priv.h264.pps = gst_buffer_new_and_alloc(b->len - 4);
-			memcpy(GST_BUFFER_DATA(self->priv.h264.pps), b->data + 4, b->len - 4);
-			self->priv.h264.pps_received = TRUE;
-		}
-
-		if (self->priv.h264.pps_received && self->priv.h264.sps_received) {
-			create_codec_data(base);
-			if (gstdsp_set_codec_data_caps(base, self->priv.h264.codec_data)) {
-				self->priv.h264.codec_data_done = TRUE;
-				gst_buffer_replace(&self->priv.h264.sps, NULL);
-				gst_buffer_replace(&self->priv.h264.pps, NULL);
-				gst_buffer_replace(&self->priv.h264.codec_data, NULL);
-			}
-		}
-		base->skip_hack_2++;
-	}
+	gstdsp_venc_set_frame_info(base, tb, param->frame_type,
+			param->nalus_per_frame, param->ext_error_code);
 }
 
 static void setup_in_params(GstDspBase *base,  dmm_buffer_t *tmp)
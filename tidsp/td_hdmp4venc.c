@@ -195,6 +195,9 @@ static void out_recv_cb(GstDspBase *base, struct td_buffer *tb)
 		b->skip = TRUE;
 	else
 		b->skip = FALSE;
+
+	gstdsp_venc_set_frame_info(base, tb, param->frame_type, 0,
+			param->ext_error_code);
 }
 
 static void in_send_cb(GstDspBase *base, struct td_buffer *tb)
@@ -204,13 +207,8 @@ static void in_send_cb(GstDspBase *base, struct td_buffer *tb)
 
 	param = tb->params->data;
 	param->frame_index = g_atomic_int_exchange_and_add(&self->frame_index, 1);
-	g_mutex_lock(self->keyframe_mutex);
-	param->force_i_frame = self->keyframe_event ? 1 : 0;
-	if (self->keyframe_event) {
-		gst_pad_push_event(base->srcpad, self->keyframe_event);
-		self->keyframe_event = NULL;
-	}
-	g_mutex_unlock(self->keyframe_mutex);
+	param->bitrate = g_atomic_int_get(&self->bitrate);
+	param->force_i_frame = gstdsp_venc_keyframe_pending(base, tb);
 }
 
 static void setup_in_params(GstDspBase *base, dmm_buffer_t *tmp)
@@ -14,6 +14,9 @@
 #include "gstdspbase.h"
 #include "gstdspjpegenc.h"
 
+/* the node gets some headroom over the largest image it's going to see */
+#define JPEGENC_MARGIN 32
+
 struct create_args {
 	uint32_t size;
 	uint16_t num_streams;
@@ -45,6 +48,9 @@ struct create_args {
 
 static void create_args(GstDspBase *base, unsigned *profile_id, void **arg_data)
 {
+	GstDspJpegEnc *jpegenc = GST_DSP_JPEGENC(base);
+	GstDspVEnc *self = GST_DSP_VENC(base);
+
 	struct create_args args = {
 		.size = sizeof(args) - 4,
 		.num_streams = 2,
@@ -54,11 +60,15 @@ static void create_args(GstDspBase *base, unsigned *profile_id, void **arg_data)
 		.out_id = 1,
 		.out_type = 0,
 		.out_count = base->ports[1]->num_buffers,
-		.max_width = JPEGENC_MAX_WIDTH + 32,
-		.max_height = JPEGENC_MAX_HEIGHT + 32,
+		.max_width = JPEGENC_MAX_WIDTH + JPEGENC_MARGIN,
+		.max_height = JPEGENC_MAX_HEIGHT + JPEGENC_MARGIN,
 		.color_format = 1,
 	};
 
+	/* only one strip at a time */
+	if (jpegenc->strips.count)
+		args.max_height = self->height + JPEGENC_MARGIN;
+
 	*profile_id = 1;
 
 	*arg_data = malloc(sizeof(args));
@@ -114,6 +124,7 @@ static void send_params(GstDspBase *base, struct dsp_node *node)
 	struct dyn_params *params;
 	dmm_buffer_t *b;
 	GstDspVEnc *self = GST_DSP_VENC(base);
+	GstDspJpegEnc *jpegenc = GST_DSP_JPEGENC(base);
 
 	b = dmm_buffer_calloc(base->dsp_handle, base->proc,
 			DYN_PARAMS_SIZE_VER(base,params), DMA_TO_DEVICE);
@@ -128,6 +139,10 @@ static void send_params(GstDspBase *base, struct dsp_node *node)
 
 	DYN_PARAMS_VER(base,params,capture_height) = self->height;
 
+	/* a restart after every row of MCUs, so strips can be stitched */
+	if (jpegenc->strips.count)
+		DYN_PARAMS_VER(base,params,dri_interval) = ROUND_UP(self->width, 16) / 16;
+
 	gstdsp_send_alg_ctrl(base, base->node, b);
 }
 
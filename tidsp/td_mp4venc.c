@@ -171,6 +171,9 @@ static void out_recv_cb(GstDspBase *base, struct td_buffer *tb)
 	tb->keyframe = (param->frame_type == 1);
 	if (base->alg == GSTDSP_MP4VENC)
 		td_mp4venc_try_extract_extra_data(base, tb->data);
+
+	gstdsp_venc_set_frame_info(base, tb, param->frame_type, param->num_packets,
+			base->sn_api >= 1 ? (gint) param->error_code : 0);
 }
 
 static void in_send_cb(GstDspBase *base, struct td_buffer *tb)
@@ -181,13 +184,7 @@ static void in_send_cb(GstDspBase *base, struct td_buffer *tb)
 	param = tb->params->data;
 	param->frame_index = g_atomic_int_exchange_and_add(&self->frame_index, 1);
 	param->bitrate = g_atomic_int_get(&self->bitrate);
-	g_mutex_lock(self->keyframe_mutex);
-	param->force_i_frame = self->keyframe_event ? 1 : 0;
-	if (self->keyframe_event) {
-		gst_pad_push_event(base->srcpad, self->keyframe_event);
-		self->keyframe_event = NULL;
-	}
-	g_mutex_unlock(self->keyframe_mutex);
+	param->force_i_frame = gstdsp_venc_keyframe_pending(base, tb);
 }
 
 static void setup_in_params(GstDspBase *base, dmm_buffer_t *tmp)
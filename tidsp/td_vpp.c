@@ -57,7 +57,7 @@ static void create_args(GstDspBase *base, unsigned *profile_id, void **arg_data)
 		.ov_count = 1,
 		.rgb_id = 2,
 		.rgb_type = 0,
-		.rgb_count = 1,
+		.rgb_count = MAX(self->rgb_port->num_buffers, 1),
 		.yuv_id = 3,
 		.yuv_type = 0,
 		.yuv_count = base->ports[1]->num_buffers,
@@ -146,8 +146,19 @@ static void setup_out_params(GstDspBase *base, dmm_buffer_t *tmp)
 	out_param->offset = self->out_width * self->out_height;
 }
 
+static void setup_rgb_params(GstDspBase *base, dmm_buffer_t *tmp)
+{
+	struct out_params *out_param;
+	GstDspVpp *self = GST_DSP_VPP(base);
+
+	out_param = tmp->data;
+	out_param->width = self->rgb_width;
+	out_param->height = self->rgb_height;
+}
+
 static void setup_params(GstDspBase *base)
 {
+	GstDspVpp *self = GST_DSP_VPP(base);
 	struct in_params *in_param;
 	struct out_params *out_param;
 	du_port_t *p;
@@ -157,6 +168,10 @@ static void setup_params(GstDspBase *base)
 
 	p = base->ports[1];
 	gstdsp_port_setup_params(base, p, sizeof(*out_param), setup_out_params);
+
+	p = self->rgb_port;
+	if (p->num_buffers)
+		gstdsp_port_setup_params(base, p, sizeof(*out_param), setup_rgb_params);
 }
 
 struct td_codec td_vpp_codec = {
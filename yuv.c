@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#include "yuv.h"
+
+#include <string.h> /* for memcpy */
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+void yuv_copy_plane(uint8_t *dst, unsigned dst_stride,
+		const uint8_t *src, unsigned src_stride,
+		unsigned width, unsigned height)
+{
+	unsigned y;
+
+	if (dst_stride == width && src_stride == width) {
+		memcpy(dst, src, width * height);
+		return;
+	}
+
+	for (y = 0; y < height; y++) {
+		memcpy(dst, src, width);
+		dst += dst_stride;
+		src += src_stride;
+	}
+}
+
+void yuv_split_uv(uint8_t *u, uint8_t *v, unsigned dst_stride,
+		const uint8_t *src, unsigned src_stride,
+		unsigned width, unsigned height)
+{
+	unsigned x, y;
+
+	for (y = 0; y < height; y++) {
+		x = 0;
+#ifdef __ARM_NEON__
+		for (; x + 16 <= width; x += 16) {
+			uint8x16x2_t uv = vld2q_u8(src + x * 2);
+			vst1q_u8(u + x, uv.val[0]);
+			vst1q_u8(v + x, uv.val[1]);
+		}
+#endif
+		for (; x < width; x++) {
+			u[x] = src[x * 2];
+			v[x] = src[x * 2 + 1];
+		}
+		u += dst_stride;
+		v += dst_stride;
+		src += src_stride;
+	}
+}
+
+void yuv_swap_bytes(uint8_t *dst, unsigned dst_stride,
+		const uint8_t *src, unsigned src_stride,
+		unsigned width, unsigned height)
+{
+	unsigned x, y;
+
+	for (y = 0; y < height; y++) {
+		x = 0;
+#ifdef __ARM_NEON__
+		for (; x + 16 <= width; x += 16)
+			vst1q_u8(dst + x, vrev16q_u8(vld1q_u8(src + x)));
+#endif
+		for (; x + 1 < width; x += 2) {
+			dst[x] = src[x + 1];
+			dst[x + 1] = src[x];
+		}
+		dst += dst_stride;
+		src += src_stride;
+	}
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#ifndef YUV_H
+#define YUV_H
+
+#include <stdint.h>
+
+/*
+ * Repacking of raw frames into the layout the DSP wants; the strides are in
+ * bytes, and the widths in samples of the destination.
+ */
+
+void yuv_copy_plane(uint8_t *dst, unsigned dst_stride,
+		const uint8_t *src, unsigned src_stride,
+		unsigned width, unsigned height);
+
+/* interleaved chroma (NV12) into separate planes */
+void yuv_split_uv(uint8_t *u, uint8_t *v, unsigned dst_stride,
+		const uint8_t *src, unsigned src_stride,
+		unsigned width, unsigned height);
+
+/* YUY2 <-> UYVY; width in bytes */
+void yuv_swap_bytes(uint8_t *dst, unsigned dst_stride,
+		const uint8_t *src, unsigned src_stride,
+		unsigned width, unsigned height);
+
+#endif /* YUV_H */